@@ -0,0 +1,201 @@
+#include "simulador.h"
+
+#include <QJsonDocument>
+#include <QList>
+#include <QTest>
+
+#include <functional>
+#include <memory>
+
+/*
+ * Micro-benchmarks de cada etapa del camino de una solicitud, por endpoint:
+ * parseo del JSON (parse), lectura de campos (extraer), validación
+ * (validar), datos de la respuesta (aprobar), armado del objeto JSON
+ * (construir) y serialización (serializar), además de makeErrorResponse y
+ * los headers que agrega afterRequest.
+ *
+ * tiempo() informa ns/op con QBENCHMARK; asignaciones() informa cuántas
+ * asignaciones hace cada etapa por operación.
+ */
+
+/*
+ * Conteo de asignaciones. Qt reserva la memoria de QString, QByteArray y
+ * QJsonObject con malloc() y no con new, así que se intercepta malloc
+ * directamente (solo con glibc, y solo en este binario). El contador es por
+ * hilo para no agregar contención.
+ */
+#if defined(__GLIBC__)
+static thread_local quint64 asignacionesHilo = 0;
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+// glibc declara estas funciones como noexcept en C++
+void *malloc(size_t size) noexcept {
+  ++asignacionesHilo;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) noexcept {
+  ++asignacionesHilo;
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) noexcept {
+  ++asignacionesHilo;
+  return __libc_realloc(ptr, size);
+}
+}
+#endif
+
+namespace {
+
+struct Caso {
+  const char *endpoint;
+  pos::Operacion operacion;
+  QByteArray cuerpo;
+};
+
+struct Etapa {
+  QString endpoint;
+  QString nombre;
+  std::function<qsizetype()> correr;
+};
+
+volatile qsizetype sumidero = 0;
+
+QList<Etapa> armarEtapas() {
+  const QByteArray venta = R"({"facturaNro": 12345, "cuotas": 3, "plan": 1,
+                                "monto": 150000})";
+  const QByteArray pago = R"({"facturaNro": 12345, "monto": 150000})";
+
+  const QList<Caso> casos = {
+      {endpoint::eco, pos::Operacion::Eco, R"({"eco": 42})"},
+      {endpoint::ventaUx, pos::Operacion::VentaUx, venta},
+      {endpoint::credito, pos::Operacion::Credito, venta},
+      {endpoint::debito, pos::Operacion::Debito, pago},
+      {endpoint::descuento, pos::Operacion::Descuento,
+       R"({"nsu": "1234567", "bin": "123456", "monto": 150000})"},
+      {endpoint::ventaQr, pos::Operacion::VentaQr, pago},
+      {endpoint::ventaCanje, pos::Operacion::VentaCanje, pago},
+      {endpoint::ventaBilletera, pos::Operacion::VentaBilletera, pago},
+  };
+
+  struct Preparado {
+    Caso caso;
+    QJsonObject req;
+    pos::Solicitud solicitud;
+    pos::Resultado resultado;
+    QJsonObject resp;
+  };
+
+  QList<Etapa> etapas;
+
+  for (const auto &caso : casos) {
+    auto p = std::make_shared<Preparado>();
+    p->caso = caso;
+    p->req = *byteArrayToJsonObject(caso.cuerpo);
+    p->solicitud = pos::desdeJson(caso.operacion, p->req);
+    p->resultado = pos::aprobar(p->solicitud);
+    p->resp = pos::aJson(p->solicitud, p->resultado);
+
+    etapas << Etapa{caso.endpoint, "parse", [p] {
+                      return byteArrayToJsonObject(p->caso.cuerpo)->size();
+                    }};
+    etapas << Etapa{caso.endpoint, "extraer", [p] {
+                      return qsizetype(
+                          pos::desdeJson(p->caso.operacion, p->req).monto);
+                    }};
+    etapas << Etapa{caso.endpoint, "validar", [p] {
+                      return qsizetype(pos::validar(p->solicitud).has_value());
+                    }};
+    etapas << Etapa{caso.endpoint, "aprobar", [p] {
+                      return qsizetype(pos::aprobar(p->solicitud).delay);
+                    }};
+    etapas << Etapa{caso.endpoint, "construir", [p] {
+                      return pos::aJson(p->solicitud, p->resultado).size();
+                    }};
+    etapas << Etapa{caso.endpoint, "serializar", [p] {
+                      return QJsonDocument(p->resp)
+                          .toJson(QJsonDocument::Compact)
+                          .size();
+                    }};
+  }
+
+  pos::Solicitud qr;
+  qr.operacion = pos::Operacion::VentaQr;
+  const auto resp = pos::aJson(qr, pos::aprobar(qr));
+
+  etapas << Etapa{"*", "error", [] {
+                    return makeErrorResponse("Bad request", "JSON inválido",
+                                             400)
+                        .size();
+                  }};
+  etapas << Etapa{"*", "respuesta", [resp] {
+                    return QHttpServerResponse(resp).data().size();
+                  }};
+  // Incluye armar la respuesta; restar "respuesta" para aislar los headers.
+  etapas << Etapa{"*", "headers", [resp] {
+                    return server::agregarHeaders(QHttpServerResponse(resp))
+                        .data()
+                        .size();
+                  }};
+  return etapas;
+}
+
+const QList<Etapa> &etapas() {
+  static const QList<Etapa> todas = armarEtapas();
+  return todas;
+}
+
+void filas() {
+  QTest::addColumn<int>("etapa");
+  for (int i = 0; i < etapas().size(); ++i) {
+    const auto &e = etapas()[i];
+    QTest::newRow(qPrintable(e.endpoint + u' ' + e.nombre)) << i;
+  }
+}
+
+} // namespace
+
+class BenchPos : public QObject {
+  Q_OBJECT
+
+private slots:
+  void tiempo_data() { filas(); }
+
+  void tiempo() {
+    QFETCH(int, etapa);
+    const auto &correr = etapas()[etapa].correr;
+    QBENCHMARK { sumidero = sumidero + correr(); }
+  }
+
+  void asignaciones_data() { filas(); }
+
+  void asignaciones() {
+#if defined(__GLIBC__)
+    QFETCH(int, etapa);
+    const auto &correr = etapas()[etapa].correr;
+    static constexpr int iteraciones = 10000;
+
+    for (int i = 0; i < 100; ++i)
+      sumidero = sumidero + correr();
+
+    const auto antes = asignacionesHilo;
+    for (int i = 0; i < iteraciones; ++i)
+      sumidero = sumidero + correr();
+    const auto asignadas = asignacionesHilo - antes;
+
+    // Se informa como "events" por iteración.
+    QTest::setBenchmarkResult(qreal(asignadas) / iteraciones, QTest::Events);
+#else
+    QSKIP("Contar asignaciones requiere glibc");
+#endif
+  }
+};
+
+QTEST_GUILESS_MAIN(BenchPos)
+
+#include "bench.moc"
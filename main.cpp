@@ -1,27 +1,61 @@
+#include "simulador.h"
+
+#include <QCache>
+#include <QCommandLineParser>
 #include <QCoreApplication>
 #include <QDateTime>
 #include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
 #include <QFile>
+#include <QHash>
 #include <QHttpServer>
 #include <QHttpServerResponse>
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QMap>
+#include <QMutex>
 #include <QString>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QThread>
+#include <QTimer>
+#include <QUrlQuery>
+#include <QtEndian>
+#include <QtMath>
 #include <QtHttpServer/QHttpServerResponse>
 #include <QRandomGenerator>
+#include <QRegularExpression>
+#include <QSocketNotifier>
+
+#include <atomic>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#ifdef Q_OS_UNIX
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
 
 
 using namespace Qt::StringLiterals;
 
 namespace util {
 
-void delay(int ms) {
-    qDebug().noquote().nospace() << " > Simulando delay de " << ms << "ms";
-    QThread::msleep(ms);
-    qDebug().noquote().nospace() << " > Continuando...";
-}
-
 int randomInt(int lbound, int hbound) {
   QRandomGenerator *rng = QRandomGenerator::global();
 
@@ -34,655 +68,2494 @@ quint64 randomLong(quint64 lbound, quint64 hbound) {
   return rng->bounded(lbound, hbound);
 }
 
+static constexpr qsizetype logMaxBytes = 512;
+
+/// Recorta lo que se vuelca al log para que un cliente que envía basura
+/// de varios MB no sature la salida.
+QByteArray recortar(const QByteArray &data, qsizetype max = logMaxBytes) {
+  if (data.size() <= max)
+    return data;
+  return data.left(max) + "... (" + QByteArray::number(data.size() - max) +
+         " bytes omitidos)";
+}
+
+QByteArray recortar(const QJsonObject &obj, qsizetype max = logMaxBytes) {
+  return recortar(QJsonDocument(obj).toJson(QJsonDocument::Indented), max);
+}
+
 } // namespace util
 
-namespace endpoint {
+/*
+ * Reloj virtual. La latencia simulada, el plazo de drenaje y las fechas que
+ * devuelve el simulador se miden con este reloj y no con el de pared.
+ *
+ * Corre `velocidad` veces más rápido que el tiempo real (con 60, una hora
+ * simulada dura un minuto). En modo paso no avanza solo: lo adelanta
+ * avanzar(), y recién ahí se disparan las esperas vencidas, en orden. Así
+ * una prueba obtiene siempre las mismas fechas y el mismo orden de respuestas.
+ */
+namespace tiempo {
+
+struct Espera {
+  QObject *contexto = nullptr;
+  std::function<void()> accion;
+  QMetaObject::Connection destruido;
+};
+
+// Vencimiento y orden de llegada, para disparar en orden las que vencen juntas.
+using Clave = std::pair<qint64, quint64>;
+
+static double velocidad = 1.0;
+static bool modoPaso = false;
+static qint64 inicioMs = 0;
+static QElapsedTimer real;
+static std::atomic<qint64> avanzadoMs{0};
+
+static QMutex mutex; // protege esperas y llegadas
+static QMap<Clave, Espera> esperas;
+static quint64 llegadas = 0;
+
+void configurar(double multiplicador, bool paso, qint64 inicio) {
+  velocidad = multiplicador > 0 ? multiplicador : 1.0;
+  modoPaso = paso;
+  inicioMs = inicio;
+  real.start();
+}
 
-static constexpr auto eco = "/pos/eco";
-static constexpr auto ventaUx = "/pos/venta-ux";
-static constexpr auto credito = "/pos/venta/credito";
-static constexpr auto debito = "/pos/venta/debito";
-static constexpr auto descuento = "/pos/descuento";
-static constexpr auto ventaQr = "/pos/venta-qr";
-static constexpr auto ventaCanje = "/pos/venta-canje";
-static constexpr auto ventaBilletera = "/pos/venta-billetera";
+/// Milisegundos desde la época en el reloj virtual.
+qint64 ahoraMs() {
+  if (modoPaso)
+    return inicioMs + avanzadoMs.load(std::memory_order_acquire);
+  return inicioMs + qint64(real.elapsed() * velocidad);
+}
 
-static constexpr auto listarIssuers = "/issuers/";
-static constexpr auto listarBilleteras = "/billeteras/";
+QDateTime ahora() { return QDateTime::fromMSecsSinceEpoch(ahoraMs()); }
 
-} // namespace endpoint
+/// Cuánto tiempo real dura `ms` de tiempo virtual (en modo paso, lo mismo).
+qint64 aReal(qint64 ms) {
+  return modoPaso ? ms : qMax<qint64>(1, qRound64(ms / velocidad));
+}
 
-namespace server {
+/// Quita la espera de un contexto que se destruyó, si todavía no se disparó.
+static void descartar(Clave clave) {
+  std::function<void()> accion; // se destruye fuera del mutex
+  QMutexLocker lock(&mutex);
+  const auto it = esperas.find(clave);
+  if (it == esperas.end())
+    return;
+  accion = std::move(it->accion);
+  esperas.erase(it);
+}
 
-static constexpr auto default_address = "localhost";
-static constexpr auto default_port = 3000;
+/// Ejecuta `accion` en el hilo de `contexto` dentro de `ms` virtuales.
+void despues(qint64 ms, QObject *contexto, std::function<void()> accion) {
+  if (!modoPaso || ms <= 0) {
+    QTimer::singleShot(ms <= 0 ? 0 : int(aReal(ms)), contexto,
+                       std::move(accion));
+    return;
+  }
+  if (!contexto)
+    return;
+
+  // Si el contexto (la conexión) se destruye antes de que venza, la espera se
+  // descarta junto con lo que retiene la acción, como el registro en vuelo.
+  QMutexLocker lock(&mutex);
+  const Clave clave{ahoraMs() + ms, llegadas++};
+  auto &espera = esperas[clave];
+  espera.contexto = contexto;
+  espera.accion = std::move(accion);
+  espera.destruido = QObject::connect(contexto, &QObject::destroyed,
+                                      [clave] { descartar(clave); });
+}
 
-QUrl formatUrl(const QString &route, const QString &ip = default_address,
-               int port = default_port) noexcept {
-  static const auto fmt = QString{"http://%1:%2/%3"};
-    return fmt.arg(ip, QString::number(port), route);
+/// Adelanta el reloj en modo paso. Devuelve cuántas esperas se dispararon.
+int avanzar(qint64 ms) {
+  QList<QMetaObject::Connection> vencidas;
+  {
+    QMutexLocker lock(&mutex);
+    const auto hasta = avanzadoMs.load() + qMax<qint64>(0, ms);
+    avanzadoMs.store(hasta, std::memory_order_release);
+
+    // Mientras la espera sigue en la tabla su contexto está vivo: antes de
+    // destruirse la quita con descartar(), que necesita este mutex.
+    auto it = esperas.begin();
+    while (it != esperas.end() && it.key().first <= inicioMs + hasta) {
+      QMetaObject::invokeMethod(it->contexto, std::move(it->accion),
+                                Qt::QueuedConnection);
+      vencidas << it->destruido;
+      it = esperas.erase(it);
+    }
+  }
+
+  for (const auto &conexion : std::as_const(vencidas))
+    QObject::disconnect(conexion);
+  return vencidas.size();
 }
 
-} // namespace server
+QJsonObject estado() {
+  QMutexLocker lock(&mutex);
+  return QJsonObject{
+      {"ahora", ahora().toString(Qt::ISODateWithMs)},
+      {"velocidad", velocidad},
+      {"paso", modoPaso},
+      {"esperasPendientes", esperas.size()},
+  };
+}
 
+} // namespace tiempo
 
 
-static const auto POST = QHttpServerRequest::Method::Post;
-static const auto GET = QHttpServerRequest::Method::Get;
+/*
+ * Instrumentación: etapas de cada solicitud, lag del event loop y traza en
+ * formato Chrome trace-event (se abre con Perfetto o chrome://tracing).
+ *
+ * Los tiempos son microsegundos desde el inicio del programa.
+ */
+namespace traza {
+
+struct Etapas {
+  QByteArray nombre;
+  int status = 0;
+  qint64 llegada = 0;    // bytes de la solicitud levantados del socket
+  qint64 inicio = 0;     // el handler recibe la solicitud ya parseada
+  qint64 finProceso = 0; // validación y respuesta listas, empieza el delay
+  qint64 finDelay = 0;   // termina la latencia simulada
+  qint64 envio = 0;      // la respuesta se entrega al transporte
+};
+
+static QElapsedTimer reloj;
+static qint64 umbralLentoUs = 0; // 0: desactivado
+
+static QMutex mutex;
+static QFile *archivo = nullptr;
+static bool primerEvento = true;
+
+static std::atomic<qint64> lagUltimoUs{0};
+static std::atomic<qint64> lagMaximoUs{0};
+static std::atomic<quint64> solicitudes{0};
+static std::atomic<quint64> lentas{0};
+
+static thread_local qint64 llegadaActual = 0;
+
+qint64 ahora() { return reloj.nsecsElapsed() / 1000; }
+
+static int idHilo() {
+  static std::atomic<int> siguiente{1};
+  static thread_local int id = siguiente++;
+  return id;
+}
 
-static inline QString host(const QHttpServerRequest &request) {
-  return QString::fromLatin1(request.value("Host"));
+bool abrir(const QString &ruta) {
+  auto *f = new QFile(ruta);
+  if (!f->open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+    qWarning().noquote() << "No se pudo abrir la traza" << ruta << ":"
+                         << f->errorString();
+    delete f;
+    return false;
+  }
+  f->write("[\n");
+  archivo = f;
+  return true;
 }
 
-static std::optional<QJsonObject> byteArrayToJsonObject(const QByteArray &arr) {
-  QJsonParseError err;
-  const auto json = QJsonDocument::fromJson(arr, &err);
-  if (err.error || !json.isObject())
-    return std::nullopt;
-  return json.object();
+void cerrar() {
+  QMutexLocker lock(&mutex);
+  if (!archivo)
+    return;
+  archivo->write("\n]\n");
+  archivo->close();
+  delete archivo;
+  archivo = nullptr;
 }
 
-static QJsonObject makeErrorResponse(const QString error,
-                                     const QString message,
-                                     int statusCode) {
-  return QJsonObject{
-      {"statusCode", statusCode}, {"error", error}, {"message", message}};
+/// Escribe un evento; hay que tener tomado el mutex.
+static void escribir(const QJsonObject &evento) {
+  if (!primerEvento)
+    archivo->write(",\n");
+  primerEvento = false;
+  archivo->write(QJsonDocument(evento).toJson(QJsonDocument::Compact));
 }
 
+static QJsonObject completo(const QString &nombre, qint64 desde, qint64 hasta,
+                            int tid) {
+  return QJsonObject{{"name", nombre}, {"ph", "X"},  {"ts", desde},
+                     {"dur", hasta - desde}, {"pid", 1}, {"tid", tid}};
+}
 
-void handleIndex(QHttpServer &httpServer, QHttpServerRequest::Method method,
-                 QByteArray path) {
-  httpServer.route(path, method, []() {
-    return "<head><meta charset=\"UTF-8\"></head><h1>Simulador "
-           "POS</h1><p>Basado en la especificación del POS de Bancard.</p>\n";
-  });
+/*
+ * El handler no ve el socket, así que la llegada se anota en el último
+ * readyRead del hilo: QHttpServer parsea y llama al handler dentro de ese
+ * mismo readyRead, después de este slot.
+ */
+void marcarLlegadas(QIODevice *socket) {
+  QObject::connect(socket, &QIODevice::readyRead, socket,
+                   [] { llegadaActual = ahora(); });
 }
 
-void handleEco(QHttpServer &httpServer, QHttpServerRequest::Method method,
-               const QByteArray &path) {
+qint64 llegada() { return llegadaActual ? llegadaActual : ahora(); }
 
-  httpServer.route(
-      path, QHttpServerRequest::Method::Post,
-      [](const QHttpServerRequest &request) {
-        QByteArray body = request.body();
+void registrar(Etapas e) {
+  ++solicitudes;
 
-        QJsonParseError error;
-        auto parsedDocument = QJsonDocument::fromJson(body, &error);
+  if (!e.finProceso)
+    e.finProceso = e.envio;
+  if (!e.finDelay)
+    e.finDelay = e.finProceso;
 
-        qInfo().noquote().nospace()
-            << "Eco: " << parsedDocument.toJson(QJsonDocument::Compact);
+  const auto total = e.envio - e.llegada;
 
-        if (error.error || !parsedDocument.isObject()) {
-          return QHttpServerResponse(
-              makeErrorResponse(
-                  "Bad request",
-                  error.errorString() + ": JSON con formato erróneo", 400),
-              QHttpServerResponder::StatusCode::BadRequest);
-        }
+  if (umbralLentoUs > 0 && total >= umbralLentoUs) {
+    ++lentas;
+    qWarning().noquote().nospace()
+        << "Solicitud lenta " << e.nombre << " [" << e.status << "] "
+        << total / 1000.0 << "ms: espera " << (e.inicio - e.llegada) / 1000.0
+        << "ms, proceso " << (e.finProceso - e.inicio) / 1000.0
+        << "ms, delay " << (e.finDelay - e.finProceso) / 1000.0
+        << "ms, envío " << (e.envio - e.finDelay) / 1000.0 << "ms";
+  }
 
-        auto obj = parsedDocument.object();
-
-        if (const QJsonValue v = obj["eco"]; v.isDouble()) {
-          int val = (v.toInt());
-          if (val >= 0 && val < 100) {
-
-            /// Simular delay artificial
-            auto delay = 8; // 10 + (val * 10);
-            util::delay(delay);
-            qDebug().noquote().nospace()
-                << "Respondiendo " << val << " despues de " << delay << "ms";
-
-            return QHttpServerResponse(parsedDocument.object(),
-                                       QHttpServerResponder::StatusCode::Ok);
-          } else {
-            return QHttpServerResponse(
-                makeErrorResponse(
-                    "Bad request",
-                    QString("Valor fuera del rango admitido [%1]: %2")
-                        .arg("1-99")
-                        .arg(val),
-                    400),
-                QHttpServerResponder::StatusCode::BadRequest);
-          }
-        }
+  QMutexLocker lock(&mutex);
+  if (!archivo)
+    return;
+
+  const auto tid = idHilo();
+  auto solicitud = completo(QString::fromUtf8(e.nombre), e.llegada, e.envio, tid);
+  solicitud["args"] = QJsonObject{{"status", e.status}};
 
-        return QHttpServerResponse(
-            makeErrorResponse("Solicitud mal formada",
-                              "Lo que recibí es basura", 400),
-            QHttpServerResponder::StatusCode::BadRequest);
-      });
+  escribir(solicitud);
+  escribir(completo("espera", e.llegada, e.inicio, tid));
+  escribir(completo("proceso", e.inicio, e.finProceso, tid));
+  escribir(completo("delay", e.finProceso, e.finDelay, tid));
+  escribir(completo("envio", e.finDelay, e.envio, tid));
 }
 
-void handleVentaUx(QHttpServer &httpServer, QHttpServerRequest::Method method,
-                   const QByteArray &path) {
+/*
+ * Sonda de lag: un timer que debería dispararse cada intervaloMs. Lo que se
+ * atrasa es el tiempo que el event loop estuvo ocupado (p. ej. parseando o
+ * escribiendo logs).
+ */
+void iniciarSonda(QObject *contexto, int intervaloMs) {
+  auto *timer = new QTimer(contexto);
+  timer->setTimerType(Qt::PreciseTimer);
+
+  auto anterior = std::make_shared<qint64>(ahora());
+
+  QObject::connect(timer, &QTimer::timeout, contexto, [anterior, intervaloMs] {
+    const auto t = ahora();
+    const auto lag = qMax<qint64>(0, t - *anterior - intervaloMs * 1000);
+    *anterior = t;
+
+    lagUltimoUs = lag;
+    if (lag > lagMaximoUs)
+      lagMaximoUs = lag;
+
+    QMutexLocker lock(&mutex);
+    if (!archivo)
+      return;
+
+    escribir(QJsonObject{{"name", "lag event loop"},
+                         {"ph", "C"},
+                         {"ts", t},
+                         {"pid", 1},
+                         {"args", QJsonObject{{"ms", lag / 1000.0}}}});
+    archivo->flush();
+  });
 
-  httpServer.route(path, method, [](const QHttpServerRequest &request) {
-    const std::optional<QJsonObject> json =
-        byteArrayToJsonObject(request.body());
+  timer->start(intervaloMs);
+}
+
+QJsonObject metricas() {
+  return QJsonObject{
+      {"solicitudes", qint64(solicitudes.load())},
+      {"solicitudesLentas", qint64(lentas.load())},
+      {"lagEventLoopMs",
+       QJsonObject{{"ultimo", lagUltimoUs / 1000.0},
+                   {"maximo", lagMaximoUs / 1000.0}}},
+  };
+}
 
-    auto status = QHttpServerResponder::StatusCode::Ok;
+} // namespace traza
 
-    if (!json)
-      return QHttpServerResponse(QHttpServerResponder::StatusCode::BadRequest);
+/*
+ * Apagado ordenado: ante CTRL+C o SIGTERM se deja de aceptar conexiones y
+ * se espera a que salgan las respuestas en vuelo (con un plazo) antes de
+ * terminar. Mientras tanto las conexiones abiertas se siguen atendiendo, pero
+ * cada respuesta lleva "Connection: close" para que el cliente se reconecte
+ * (al proceso nuevo, si hubo relevo). Una segunda señal termina en el acto.
+ */
+namespace apagado {
+
+static std::atomic<int> enVuelo{0};
+static std::atomic<bool> drenando{false};
+
+/// Mientras viva el objeto devuelto, hay una respuesta en vuelo.
+std::shared_ptr<void> registrarEnVuelo() {
+  ++enVuelo;
+  return std::shared_ptr<void>(nullptr, [](void *) { --enVuelo; });
+}
 
+void iniciar(const std::function<void()> &dejarDeAceptar, int plazoMs) {
+  if (drenando.exchange(true)) {
+    qWarning().noquote() << "Apagado forzado con" << enVuelo
+                         << "respuestas en vuelo";
+    QCoreApplication::exit(1);
+    return;
+  }
 
-//    if(ventaUxInputInvalido(json.value())){
-//      auto malformed =
-//          makeErrorResponse("Solicitud mal formada",
-//                            "La solicitud contiene datos mal formados", 401);
-//      return QHttpServerResponse(malformed,
-//                               QHttpServerResponder::StatusCode::BadRequest);
-//    }
+  qInfo().noquote().nospace() << "Apagando: esperando " << enVuelo
+                              << " respuestas en vuelo (plazo " << plazoMs
+                              << "ms)";
+  dejarDeAceptar();
+
+  auto *timer = new QTimer(qApp);
+  auto plazo = std::make_shared<QElapsedTimer>();
+  plazo->start();
+
+  QObject::connect(timer, &QTimer::timeout, qApp, [plazo, plazoMs] {
+    if (enVuelo > 0 && !plazo->hasExpired(tiempo::aReal(plazoMs)))
+      return;
+
+    if (enVuelo > 0)
+      qWarning().noquote() << "Plazo vencido, se descartan" << enVuelo
+                           << "respuestas en vuelo";
+    else
+      qInfo().noquote() << "Respuestas en vuelo drenadas";
+    QCoreApplication::quit();
+  });
+  timer->start(20);
+}
 
+#ifdef Q_OS_UNIX
+static int tuberia[2] = {-1, -1};
 
-    auto req = json.value();
+static void alRecibirSenal(int senal) {
+  const char c = char(senal);
+  const auto escritos = ::write(tuberia[1], &c, 1);
+  Q_UNUSED(escritos);
+}
 
-    auto facturaNro = req.value("facturaNro").toInteger();
-    auto cuotas = req.value("cuotas").toInt();
-    auto plan = req.value("plan").toInt();
+/*
+ * Las señales llegan por un socketpair al event loop (en el handler de la
+ * señal solo se puede escribir al descriptor).
+ */
+void instalarSenales(const std::function<void()> &alApagar) {
+  if (::socketpair(AF_UNIX, SOCK_STREAM, 0, tuberia) != 0) {
+    qWarning().noquote() << "No se pudieron instalar los handlers de señales";
+    return;
+  }
 
-    qDebug().noquote() << "\n\nFactura Numero: " << facturaNro << "\n\n";
+  auto *notificador =
+      new QSocketNotifier(tuberia[0], QSocketNotifier::Read, qApp);
+  QObject::connect(notificador, &QSocketNotifier::activated, qApp,
+                   [alApagar] {
+                     char c;
+                     if (::read(tuberia[0], &c, 1) == 1)
+                       alApagar();
+                   });
 
-    if (facturaNro < 1 || facturaNro > 99999999999) {
-      status = QHttpServerResponder::StatusCode::NotAcceptable;
-      auto eResp = makeErrorResponse("Bad request",
-                                     "Número de factura inválido", (int)status);
+  struct sigaction sa = {};
+  sa.sa_handler = alRecibirSenal;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESTART;
+  sigaction(SIGINT, &sa, nullptr);
+  sigaction(SIGTERM, &sa, nullptr);
+}
+#endif
 
-      qDebug().noquote().nospace()
-          << request.url().toDisplayString(QUrl::RemoveQuery) << " <==\n"
-          << QJsonDocument(req).toJson(QJsonDocument::JsonFormat::Indented)
-          << "==> [" << (int)status << "]\n"
-          << QJsonDocument(eResp).toJson(QJsonDocument::Indented) << "\n";
+} // namespace apagado
 
-      return QHttpServerResponse(eResp, status);
-    }
+namespace limits {
 
-    if (cuotas < 0 || cuotas > 99 || plan < 0 || plan > 1) {
-      status = QHttpServerResponder::StatusCode::NotAcceptable;
-      auto eResp = makeErrorResponse(
-          "Bad request", "Combinación inválida de Cuotas/Plan", (int)status);
+static constexpr qsizetype default_max_body = 16 * 1024;
 
-      qDebug().noquote().nospace()
-          << request.url().toDisplayString(QUrl::RemoveQuery) << " <==\n"
-          << QJsonDocument(req).toJson(QJsonDocument::JsonFormat::Indented)
-          << "==> [" << (int)status << "]\n"
-          << QJsonDocument(eResp).toJson(QJsonDocument::Indented) << "\n";
+static qsizetype maxBodyPorDefecto = default_max_body;
+static QHash<QByteArray, qsizetype> maxBodyPorRuta;
+static bool exigirContentType = false;
 
-      return QHttpServerResponse(eResp, status);
-    }
+qsizetype maxBody(const QByteArray &path) {
+  return maxBodyPorRuta.value(path, maxBodyPorDefecto);
+}
 
-    auto delay = 1500;
+/// Acepta "ruta=bytes" (límite para una ruta) o solo "bytes" (límite por
+/// defecto).
+bool configurar(const QString &spec) {
+  const auto sep = spec.lastIndexOf(u'=');
+  bool ok = false;
+  const auto bytes = spec.sliced(sep + 1).toLongLong(&ok);
+  if (!ok || bytes < 0)
+    return false;
+
+  if (sep < 0)
+    maxBodyPorDefecto = bytes;
+  else
+    maxBodyPorRuta.insert(spec.first(sep).toUtf8(), bytes);
+  return true;
+}
 
-    util::delay(delay);
+static constexpr qsizetype maxCabeceras = 16 * 1024;
+
+/// Contesta sin pasar por QHttpServer y corta la conexión.
+static void cortar(QIODevice *socket, int status, const QByteArray &razon,
+                   const QString &mensaje) {
+  const QJsonObject error{{"statusCode", status},
+                          {"error", QString::fromLatin1(razon)},
+                          {"message", mensaje}};
+  const auto cuerpo = QJsonDocument(error).toJson(QJsonDocument::Compact);
+  socket->write("HTTP/1.1 " + QByteArray::number(status) + ' ' + razon +
+                "\r\nContent-Type: application/json\r\nContent-Length: " +
+                QByteArray::number(cuerpo.size()) +
+                "\r\nServer: SimuladorPOS\r\nAutor: Diego Schulz"
+                "\r\nConnection: close\r\n\r\n" +
+                cuerpo);
+
+  if (auto *tcp = qobject_cast<QAbstractSocket *>(socket)) {
+    tcp->flush();
+    tcp->abort();
+  } else if (auto *local = qobject_cast<QLocalSocket *>(socket)) {
+    local->flush();
+    local->abort();
+  }
+}
 
-    QJsonObject nsuBin;
-    nsuBin["nsu"] = "UX" + QString::number(util::randomInt(1, 9999999));
-    nsuBin["bin"] = "UX" + QString::number(util::randomInt(1, 999999));
+/// Revisa los encabezados de una solicitud; true si puede seguir.
+static bool admitir(QIODevice *socket, QByteArrayView cabeceras,
+                    qint64 &largo) {
+  const auto lineas = cabeceras.toByteArray().split('\n');
+  auto path = lineas.value(0).split(' ').value(1);
+  if (const auto q = path.indexOf('?'); q >= 0)
+    path.truncate(q);
+
+  largo = 0;
+  for (const auto &linea : lineas) {
+    const auto sep = linea.indexOf(':');
+    if (sep < 0)
+      continue;
+    const auto nombre = linea.first(sep).trimmed().toLower();
+    const auto valor = linea.sliced(sep + 1).trimmed();
+
+    if (nombre == "content-length") {
+      bool ok = false;
+      largo = valor.toLongLong(&ok);
+      if (!ok || largo < 0) {
+        cortar(socket, 400, "Bad Request", "Content-Length inválido");
+        return false;
+      }
+    } else if (nombre == "transfer-encoding" &&
+               valor.toLower().contains("chunked")) {
+      qDebug().noquote().nospace()
+          << path << " <== Transfer-Encoding: chunked ==> [411]";
+      cortar(socket, 411, "Length Required",
+             "El cuerpo tiene que declarar su Content-Length");
+      return false;
+    }
+  }
 
+  const auto max = maxBody(path);
+  if (largo > max) {
     qDebug().noquote().nospace()
-        << request.url().toDisplayString(QUrl::RemoveQuery) << "\n"
-        << QJsonDocument(req).toJson(QJsonDocument::JsonFormat::Indented)
-        << "=> \n"
-        << QJsonDocument(nsuBin).toJson(QJsonDocument::Indented) << "\n";
+        << path << " <== " << largo << " bytes ==> [413] límite " << max
+        << " bytes (sin leer el cuerpo)";
+    cortar(socket, 413, "Payload Too Large",
+           QString("La solicitud excede el límite de %1 bytes").arg(max));
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Aplica maxBody() sobre el socket, antes de que QHttpServer junte el cuerpo
+ * en memoria: sigue los encabezados y el Content-Length de cada solicitud de
+ * la conexión y, si el cuerpo declarado excede el límite de la ruta, contesta
+ * 413 y corta sin leerlo. Un cuerpo chunked no declara su largo, así que se
+ * rechaza con 411.
+ *
+ * Se conecta a readyRead antes que QHttpServer y solo mira los bytes, sin
+ * consumirlos. QHttpServer no siempre lee todo lo disponible (por ejemplo,
+ * mientras una respuesta está pendiente), así que se recuerda cuántos de los
+ * bytes en el buffer ya se revisaron y se sigue después de ellos. La cuenta
+ * se corrige después de que QHttpServer lee, con una llamada encolada: fuera
+ * de readyRead todo lo que queda en el buffer ya se revisó.
+ */
+void vigilar(QIODevice *socket) {
+  struct Estado {
+    QByteArray cabeceras; // encabezados incompletos de la solicitud en curso
+    qint64 cuerpoRestante = 0;
+    qint64 revisados = 0; // bytes del buffer que ya se revisaron
+  };
+  auto estado = std::make_shared<Estado>();
+
+  QObject::connect(socket, &QIODevice::readyRead, socket, [socket, estado] {
+    const auto buffer = socket->peek(socket->bytesAvailable());
+    QByteArrayView resto(buffer);
+    resto = resto.sliced(qMin<qint64>(estado->revisados, resto.size()));
+    estado->revisados = buffer.size();
+    QMetaObject::invokeMethod(
+        socket,
+        [socket, estado] { estado->revisados = socket->bytesAvailable(); },
+        Qt::QueuedConnection);
+
+    while (!resto.isEmpty()) {
+      if (estado->cuerpoRestante > 0) {
+        const auto n = qMin<qint64>(estado->cuerpoRestante, resto.size());
+        estado->cuerpoRestante -= n;
+        resto = resto.sliced(n);
+        continue;
+      }
 
-    util::delay(1500);
+      const auto previos = estado->cabeceras.size();
+      estado->cabeceras.append(resto);
+      const auto fin = estado->cabeceras.indexOf(
+          "\r\n\r\n", qMax<qsizetype>(0, previos - 3));
+      if (fin < 0) {
+        if (estado->cabeceras.size() > maxCabeceras)
+          cortar(socket, 431, "Request Header Fields Too Large",
+                 "Encabezados demasiado largos");
+        return;
+      }
 
-    return QHttpServerResponse(nsuBin, status);
+      resto = resto.sliced(fin + 4 - previos);
+      const auto cabeceras = estado->cabeceras.first(fin);
+      estado->cabeceras.clear();
+      if (!admitir(socket, cabeceras, estado->cuerpoRestante))
+        return;
+    }
   });
 }
 
-void handleVentaCredito(QHttpServer &httpServer,
-                        QHttpServerRequest::Method method,
-                        const QByteArray &path) {
-  httpServer.route(path, method, [](const QHttpServerRequest &request) {
-    const std::optional<QJsonObject> json =
-        byteArrayToJsonObject(request.body());
-      auto status =  QHttpServerResponder::StatusCode::Ok;
-
-      if (!json){
-          status =  QHttpServerResponder::StatusCode::BadRequest;
-          auto eResp = makeErrorResponse("Bad request", "JSON inválido", (int) status);
+} // namespace limits
 
-          qDebug().noquote().nospace()
-              << request.url().toDisplayString(QUrl::RemoveQuery) << " <==\n"
-              << request.body() << Qt::endl
-              << "==> [" << (int)status << "]\n"
-              << QJsonDocument(eResp).toJson(QJsonDocument::Indented) << "\n";
+namespace server {
 
-          return QHttpServerResponse(eResp, status);
-      }
+static constexpr auto default_address = "localhost";
+static constexpr auto default_port = 3000;
 
+QUrl formatUrl(const QString &route, const QString &ip = default_address,
+               int port = default_port) noexcept {
+  static const auto fmt = QString{"http://%1:%2/%3"};
+    return fmt.arg(ip, QString::number(port), route);
+}
 
-      auto req = json.value();
+static thread_local QObject *conexion = nullptr;
 
-      auto facturaNro = req.value("facturaNro").toInteger();
-      auto cuotas = req.value("cuotas").toInt();
-      auto plan = req.value("plan").toInt();
+/*
+ * Conexión por la que llegó la solicitud que se está atendiendo. Sirve de
+ * contexto para las respuestas diferidas: si el cliente corta, el timer se
+ * cancela junto con el socket.
+ */
+QObject *conexionActual() { return conexion ? conexion : qApp; }
 
-      if ( facturaNro < 1 || facturaNro > 99999999999) {
-          status =  QHttpServerResponder::StatusCode::NotAcceptable;
-          auto eResp =
-              makeErrorResponse("Bad request", "Número de factura inválido", (int) status);
+/*
+ * Deja de aceptar en un QLocalServer sin cerrarlo. close() (y el destructor)
+ * borran el archivo del socket, que después de un relevo es el mismo que usa
+ * el proceso nuevo. Se apaga el notificador del servidor y se lo desliga de
+ * su padre para que nunca se destruya; el descriptor se cierra al terminar
+ * el proceso.
+ */
+void soltar(QLocalServer *servidor) {
+  const auto notificadores = servidor->findChildren<QSocketNotifier *>(
+      Qt::FindDirectChildrenOnly);
+  for (auto *notificador : notificadores)
+    notificador->setEnabled(false);
+  servidor->setParent(nullptr);
+}
 
-              qDebug().noquote().nospace()
-              << request.url().toDisplayString(QUrl::RemoveQuery) << " <==\n"
-              << QJsonDocument(req).toJson(QJsonDocument::JsonFormat::Indented)
-              << "==> [" << (int) status << "]\n"
-              << QJsonDocument(eResp).toJson(QJsonDocument::Indented) << "\n";
+/*
+ * Deja libre la ruta de un socket local para escuchar en ella. El archivo
+ * solo se borra si quedó de un proceso que ya no está; si otro proceso atiende
+ * ahí, devuelve false (como un puerto TCP en uso) en vez de quitarle el
+ * socket.
+ */
+bool liberarRuta(const QString &ruta) {
+  QLocalSocket sonda;
+  sonda.connectToServer(ruta);
+  if (sonda.waitForConnected(500)) {
+    sonda.abort();
+    return false;
+  }
+  QLocalServer::removeServer(ruta);
+  return true;
+}
 
-          return QHttpServerResponse(eResp, status);
-      }
+/*
+ * Se engancha a cada conexión HTTP antes de que QHttpServer la procese:
+ * límite de tamaño, llegada de cada solicitud (ver traza::marcarLlegadas) y
+ * conexión actual.
+ */
+static void prepararConexion(QIODevice *socket) {
+  limits::vigilar(socket);
+  traza::marcarLlegadas(socket);
+  QObject::connect(socket, &QIODevice::readyRead, socket,
+                   [socket] { conexion = socket; });
+  QObject::connect(socket, &QObject::destroyed, [socket] {
+    if (conexion == socket)
+      conexion = nullptr;
+  });
+}
 
-      if ( cuotas <0 || cuotas>99 || plan<0 || plan>1) {
-          status =  QHttpServerResponder::StatusCode::NotAcceptable;
-          auto eResp =
-              makeErrorResponse("Bad request", "Combinación inválida de Cuotas/Plan", (int) status);
+class ServidorHttp : public QTcpServer {
+public:
+  QTcpSocket *nextPendingConnection() override {
+    auto *socket = QTcpServer::nextPendingConnection();
+    if (socket)
+      prepararConexion(socket);
+    return socket;
+  }
+};
+
+#if QT_VERSION >= QT_VERSION_CHECK(6, 8, 0)
+/// Rutas HTTP sobre un Unix domain socket; desde Qt 6.8 QHttpServer atiende
+/// QLocalServer directamente.
+class ServidorUnix : public QLocalServer {
+public:
+  bool escuchar(const QString &ruta) { return listen(ruta); }
+
+  bool adoptar(qintptr descriptor) { return listen(descriptor); }
+  qintptr descriptor() const { return socketDescriptor(); }
+
+  QString ruta() const { return fullServerName(); }
+  QString error() const { return errorString(); }
+  void cerrar() { close(); }
+  void soltar() { server::soltar(this); }
+
+  QLocalSocket *nextPendingConnection() override {
+    auto *socket = QLocalServer::nextPendingConnection();
+    if (socket)
+      prepararConexion(socket);
+    return socket;
+  }
+};
+#else
+/*
+ * Permite servir las rutas HTTP sobre un Unix domain socket. Antes de Qt 6.8
+ * QHttpServer solo sabe atender QTcpServer, así que las conexiones se
+ * aceptan con un QLocalServer y se entregan como QTcpSocket sobre el mismo
+ * descriptor; QTcpSocket solo hace read/write sobre él, que funciona igual.
+ */
+class ServidorUnix : public ServidorHttp {
+public:
+  bool escuchar(const QString &ruta) { return aceptador.listen(ruta); }
+
+  bool adoptar(qintptr descriptor) { return aceptador.listen(descriptor); }
+  qintptr descriptor() const { return aceptador.socketDescriptor(); }
+
+  QString ruta() const { return aceptador.fullServerName(); }
+  QString error() const { return aceptador.errorString(); }
+
+  void cerrar() {
+    aceptador.close();
+    close();
+  }
 
-              qDebug().noquote().nospace()
-              << request.url().toDisplayString(QUrl::RemoveQuery) << " <==\n"
-              << QJsonDocument(req).toJson(QJsonDocument::JsonFormat::Indented)
-              << "==> [" << (int) status << "]\n"
-              << QJsonDocument(eResp).toJson(QJsonDocument::Indented) << "\n";
+  // El aceptador es un miembro: se suelta todo el servidor.
+  void soltar() {
+    server::soltar(&aceptador);
+    setParent(nullptr);
+  }
 
-          return QHttpServerResponse(eResp, status);
-      }
+private:
+  class Aceptador : public QLocalServer {
+  public:
+    explicit Aceptador(ServidorUnix &servidor) : servidor(servidor) {}
 
-      auto delay = 1500;
+  protected:
+    void incomingConnection(quintptr descriptor) override {
+      servidor.recibir(qintptr(descriptor));
+    }
 
-      util::delay(delay);
+  private:
+    ServidorUnix &servidor;
+  };
+
+  void recibir(qintptr descriptor) {
+    auto *socket = new QTcpSocket(this);
+    if (!socket->setSocketDescriptor(descriptor)) {
+      qWarning().noquote() << "No se pudo adoptar la conexión local:"
+                           << socket->errorString();
+      delete socket;
+      return;
+    }
+    addPendingConnection(socket);
+    emit newConnection();
+  }
 
+  Aceptador aceptador{*this};
+};
+#endif
+
+/// Conecta un servidor a QHttpServer. Desde Qt 6.8 bind() informa si pudo
+/// (por ejemplo, rechaza un servidor que no está escuchando).
+template <typename Servidor>
+bool vincular(QHttpServer &httpServer, Servidor *servidor) {
+#if QT_VERSION >= QT_VERSION_CHECK(6, 8, 0)
+  return httpServer.bind(servidor);
+#else
+  httpServer.bind(servidor);
+  return true;
+#endif
+}
 
-      QJsonObject nsuBin;
-      nsuBin["nsu"] = QString::number(util::randomInt(1, 9999999));
-      nsuBin["bin"] = QString::number(util::randomInt(1, 999999));
+/// Headers que se agregan a todas las respuestas (ver afterRequest en main).
+QHttpServerResponse agregarHeaders(QHttpServerResponse &&resp) {
+  resp.setHeader("Server", "SimuladorPOS");
+  resp.setHeader("Autor", "Diego Schulz");
+  if (apagado::drenando)
+    resp.setHeader("Connection", "close");
 
-      qDebug().noquote().nospace()
-          << request.url().toDisplayString(QUrl::RemoveQuery) << " <==\n"
-          << QJsonDocument(req).toJson(QJsonDocument::JsonFormat::Indented)
-          << "==> [" << (int) status << "]\n" << QJsonDocument(nsuBin).toJson(QJsonDocument::Indented) << "\n";
+  return std::move(resp);
+}
 
+} // namespace server
 
-      return QHttpServerResponse(nsuBin, status);
-  });
+/*
+ * Relevo: un proceso nuevo toma los sockets que están escuchando de uno
+ * viejo, sin cerrarlos nunca. El viejo atiende --control <ruta>; el nuevo
+ * arranca con --relevar <ruta>, recibe los descriptores por SCM_RIGHTS y
+ * escucha con ellos. El viejo entonces deja de aceptar y drena. Las
+ * conexiones que llegan en el medio esperan en el backlog del kernel.
+ *
+ * Cada descriptor va acompañado de una etiqueta: 'h' para HTTP y 'b' para
+ * el protocolo binario por TCP; 'u' para HTTP, 'l' para el binario y 'c'
+ * para el control por Unix domain socket. Los Unix domain sockets los suelta
+ * el viejo sin borrar su archivo (ver server::soltar).
+ *
+ * El nuevo pide el relevo con un byte al conectarse, para que una conexión
+ * cualquiera (como la sonda de server::liberarRuta) no lo dispare.
+ */
+namespace relevo {
+
+static constexpr char pedido = 'R';
+
+#ifdef Q_OS_UNIX
+bool enviar(int socket, const QByteArray &etiquetas,
+            const QList<int> &descriptores) {
+  if (descriptores.isEmpty() || etiquetas.size() != descriptores.size())
+    return false;
+
+  const auto bytes = sizeof(int) * descriptores.size();
+  QByteArray control(CMSG_SPACE(bytes), 0);
+
+  iovec iov = {const_cast<char *>(etiquetas.constData()),
+               size_t(etiquetas.size())};
+  msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.data();
+  msg.msg_controllen = control.size();
+
+  cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(bytes);
+  memcpy(CMSG_DATA(cmsg), descriptores.constData(), bytes);
+
+  return ::sendmsg(socket, &msg, 0) == etiquetas.size();
 }
 
-void handleVentaDebito(QHttpServer &httpServer,
-                       QHttpServerRequest::Method method, QByteArray path) {
-  httpServer.route(path, method, [](const QHttpServerRequest &request) {
-    const std::optional<QJsonObject> json =
-        byteArrayToJsonObject(request.body());
-      auto status =  QHttpServerResponder::StatusCode::Ok;
-
-      if (!json){
-          status =  QHttpServerResponder::StatusCode::BadRequest;
-          auto eResp = makeErrorResponse("Bad request", "JSON inválido", (int) status);
+/// Espera un momento el pedido de relevo en una conexión de control.
+bool pidioRelevo(int socket) {
+  pollfd p = {socket, POLLIN, 0};
+  char c = 0;
+  return ::poll(&p, 1, 1000) == 1 && ::recv(socket, &c, 1, 0) == 1 &&
+         c == pedido;
+}
 
-          qDebug().noquote().nospace()
-              << request.url().toDisplayString(QUrl::RemoveQuery) << " <==\n"
-              << request.body() << Qt::endl
-              << "==> [" << (int)status << "]\n"
-              << QJsonDocument(eResp).toJson(QJsonDocument::Indented) << "\n";
+/// Ruta a la que está ligado un Unix domain socket heredado.
+QString rutaDe(int descriptor) {
+  sockaddr_un addr = {};
+  socklen_t largo = sizeof addr;
+  if (::getsockname(descriptor, reinterpret_cast<sockaddr *>(&addr),
+                    &largo) != 0)
+    return {};
+  return QFile::decodeName(addr.sun_path);
+}
 
-          return QHttpServerResponse(eResp, status);
-      }
+/// Puerto al que está ligado un socket TCP heredado (0 si no se sabe).
+quint16 puertoDe(int descriptor) {
+  sockaddr_storage addr = {};
+  socklen_t largo = sizeof addr;
+  if (::getsockname(descriptor, reinterpret_cast<sockaddr *>(&addr),
+                    &largo) != 0)
+    return 0;
+  if (addr.ss_family == AF_INET)
+    return qFromBigEndian(reinterpret_cast<sockaddr_in *>(&addr)->sin_port);
+  if (addr.ss_family == AF_INET6)
+    return qFromBigEndian(reinterpret_cast<sockaddr_in6 *>(&addr)->sin6_port);
+  return 0;
+}
 
+/// Ruta que usa QLocalServer::listen(nombre) en Unix.
+QString rutaCompleta(const QString &nombre) {
+  if (nombre.startsWith(u'/'))
+    return nombre;
+  return QDir::cleanPath(QDir::tempPath()) + u'/' + nombre;
+}
 
-      auto req = json.value();
+QHash<char, int> recibir(const QString &ruta) {
+  QHash<char, int> recibidos;
 
-      auto facturaNro = req.value("facturaNro").toInteger();
+  const int s = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (s < 0)
+    return recibidos;
 
-      if ( facturaNro<1 || facturaNro > 99999999999) {
-          status =  QHttpServerResponder::StatusCode::NotAcceptable;
-          auto eResp =
-              makeErrorResponse("Bad request", "Número de factura inválido", (int) status);
+  sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  const auto nombre = QFile::encodeName(ruta);
+  strncpy(addr.sun_path, nombre.constData(), sizeof(addr.sun_path) - 1);
 
-              qDebug().noquote().nospace()
-              << request.url().toDisplayString(QUrl::RemoveQuery) << " <==\n"
-              << QJsonDocument(req).toJson(QJsonDocument::JsonFormat::Indented)
-              << "==> [" << (int) status << "]\n"
-              << QJsonDocument(eResp).toJson(QJsonDocument::Indented) << "\n";
+  if (::connect(s, reinterpret_cast<sockaddr *>(&addr), sizeof addr) != 0 ||
+      ::write(s, &pedido, 1) != 1) {
+    qWarning().noquote() << "No se pudo conectar a" << ruta << ":"
+                         << strerror(errno);
+    ::close(s);
+    return recibidos;
+  }
 
-          return QHttpServerResponse(eResp, status);
-      }
+  static constexpr int maxDescriptores = 8;
+  char etiquetas[maxDescriptores];
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * maxDescriptores)];
 
+  iovec iov = {etiquetas, sizeof etiquetas};
+  msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof control;
 
-      QJsonObject nsuBin;
-      nsuBin["nsu"] = QString::number(util::randomInt(1, 9999999));
-      nsuBin["bin"] = QString::number(util::randomInt(1, 999999));
+  const auto n = ::recvmsg(s, &msg, 0);
+  ::close(s);
 
-      qDebug().noquote().nospace()
-          << request.url().toDisplayString(QUrl::RemoveQuery) << " <==\n"
-          << QJsonDocument(req).toJson(QJsonDocument::JsonFormat::Indented)
-          << "==> [" << (int) status << "]\n" << QJsonDocument(nsuBin).toJson(QJsonDocument::Indented) << "\n";
+  cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (n <= 0 || !cmsg || cmsg->cmsg_type != SCM_RIGHTS)
+    return recibidos;
 
+  const auto cantidad =
+      int((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+  int descriptores[maxDescriptores];
+  memcpy(descriptores, CMSG_DATA(cmsg), sizeof(int) * cantidad);
 
-      return QHttpServerResponse(nsuBin, status);
-  });
+  for (int i = 0; i < cantidad && i < n; ++i) {
+    ::fcntl(descriptores[i], F_SETFD, FD_CLOEXEC);
+    recibidos.insert(etiquetas[i], descriptores[i]);
+  }
+  return recibidos;
 }
+#endif
 
-void handleMontoDescuento(QHttpServer &httpServer,
-                          QHttpServerRequest::Method method,
-                          const QByteArray &path) {
-  httpServer.route(path, method, [](const QHttpServerRequest &request) {
-    const std::optional<QJsonObject> json =
-        byteArrayToJsonObject(request.body());
+/*
+ * Atiende --control: al primer proceso que pide el relevo le entrega los
+ * sockets y arranca el apagado de este.
+ */
+class ServidorControl : public QLocalServer {
+public:
+  using Entregar = std::function<bool(int socket)>;
+
+  explicit ServidorControl(Entregar entregar) : entregar(std::move(entregar)) {}
+
+protected:
+  void incomingConnection(quintptr descriptor) override {
+#ifdef Q_OS_UNIX
+    if (!pidioRelevo(int(descriptor))) {
+      ::close(int(descriptor));
+      return;
+    }
+    const bool ok = entregar(int(descriptor));
+    ::close(int(descriptor));
+    if (ok)
+      qInfo().noquote() << "Sockets entregados al proceso nuevo";
+    else
+      qWarning().noquote() << "No se pudieron entregar los sockets";
+#else
+    Q_UNUSED(descriptor);
+#endif
+  }
 
-    auto status =  QHttpServerResponder::StatusCode::Ok;
+private:
+  Entregar entregar;
+};
 
-    if (!json){
-      status =  QHttpServerResponder::StatusCode::BadRequest;
-        auto eResp = makeErrorResponse("Bad request", "JSON inválido", (int) status);
+} // namespace relevo
 
-        qDebug().noquote().nospace()
-            << request.url().toDisplayString(QUrl::RemoveQuery) << " <==\n"
-            << request.body() << Qt::endl
-            << "==> [" << (int)status << "]\n"
-            << QJsonDocument(eResp).toJson(QJsonDocument::Indented) << "\n";
 
-        return QHttpServerResponse(eResp, status);
-    }
+static const auto POST = QHttpServerRequest::Method::Post;
+static const auto GET = QHttpServerRequest::Method::Get;
+
+static inline QString host(const QHttpServerRequest &request) {
+  return QString::fromLatin1(request.value("Host"));
+}
 
-    auto req = json.value();
+std::optional<QJsonObject> byteArrayToJsonObject(const QByteArray &arr) {
+  QJsonParseError err;
+  const auto json = QJsonDocument::fromJson(arr, &err);
+  if (err.error || !json.isObject())
+    return std::nullopt;
+  return json.object();
+}
 
-    auto nsu = req.value("nsu").toString();
-    auto bin = req.value("bin").toString();
-    auto monto = req.value("monto").toInteger();
+QJsonObject makeErrorResponse(const QString error, const QString message,
+                              int statusCode) {
+  return QJsonObject{
+      {"statusCode", statusCode}, {"error", error}, {"message", message}};
+}
 
-    if (nsu.trimmed().isEmpty()|| bin.trimmed().isEmpty() || monto < 1) {
-        status =  QHttpServerResponder::StatusCode::NotAcceptable;
-        auto eResp =
-            makeErrorResponse("Bad request", "NSU o BIN o MONTO inválido", (int) status);
+/*
+ * Validaciones baratas que se hacen antes de parsear el cuerpo: tamaño
+ * declarado (Content-Length), tamaño real y Content-Type. Así una solicitud
+ * enorme o que no es JSON no llega nunca a QJsonDocument::fromJson. El
+ * límite de tamaño ya se aplicó sobre el socket (limits::vigilar); acá queda
+ * como resguardo.
+ */
+static std::optional<QHttpServerResponse>
+rechazarSolicitud(const QHttpServerRequest &request, const QByteArray &path) {
+  const auto max = limits::maxBody(path);
+
+  bool ok = false;
+  const auto declarado = request.value("Content-Length").toLongLong(&ok);
+  const auto recibido = request.body().size();
+
+  if ((ok && declarado > max) || recibido > max) {
+    const auto status = QHttpServerResponder::StatusCode::PayloadTooLarge;
+    qDebug().noquote().nospace()
+        << path << " <== " << (ok ? declarado : recibido) << " bytes"
+        << " ==> [" << (int)status << "] límite " << max << " bytes";
+
+    return QHttpServerResponse(
+        makeErrorResponse("Payload too large",
+                          QString("La solicitud excede el límite de %1 bytes")
+                              .arg(max),
+                          (int)status),
+        status);
+  }
 
-        qDebug().noquote().nospace()
-            << request.url().toDisplayString(QUrl::RemoveQuery) << " <==\n"
-            << QJsonDocument(req).toJson(QJsonDocument::JsonFormat::Indented)
-            << "==> [" << (int) status << "]\n"
-            << QJsonDocument(eResp).toJson(QJsonDocument::Indented) << "\n";
-
-        return QHttpServerResponse(eResp, status);
-    }
-
-    /*
-     * Espero que los errores transaccionales
-     * no se respondan en este nivel de abstracción
-     * ESTO ES SOLO UNA PRUEBA
-     */
-    if (monto > 1000000) {
-        status =  QHttpServerResponder::StatusCode::BadRequest;
-        auto eResp =
-            makeErrorResponse("Bad request", "Saldo insuficiente", (int) status);
-
-            qDebug().noquote().nospace()
-            << request.url().toDisplayString(QUrl::RemoveQuery) << " <==\n"
-            << QJsonDocument(req).toJson(QJsonDocument::JsonFormat::Indented)
-            << "==> [" << (int) status << "]\n"
-            << QJsonDocument(eResp).toJson(QJsonDocument::Indented) << "\n";
-
-        return QHttpServerResponse(eResp, status);
-    }
-
-    QJsonObject resp;
-    resp["codigoAutorizacion"] = QString::number(util::randomInt(1,999999));
-    resp["codigoComercio"] = QString::number(util::randomLong(1,9999999999));
-    resp["issuerId"] = "ZZ";
-    resp["mensajeDisplay"] = "APROBADA";
-    resp["montoVuelto"] = util::randomInt(0, 500000);
-    resp["saldo"] = util::randomInt(1, 500000000);
-    resp["nombreCliente"] = "Nombre de Alguien";
-    resp["pan"] = util::randomInt(1,9999);
-    resp["nombreTarjeta"] = "VISA ZZZZZZZ";
-    resp["nroBoleta"] = QString::number(util::randomLong(1,9999999999));
+  const auto contentType = request.value("Content-Type").trimmed().toLower();
+  const bool esJson = contentType.startsWith("application/json");
 
+  if ((!contentType.isEmpty() && !esJson) ||
+      (contentType.isEmpty() && limits::exigirContentType)) {
+    const auto status = QHttpServerResponder::StatusCode::UnsupportedMediaType;
     qDebug().noquote().nospace()
-        << request.url().toDisplayString(QUrl::RemoveQuery) << " <==\n"
-        << QJsonDocument(req).toJson(QJsonDocument::JsonFormat::Indented)
-        << "==> [" << (int) status << "]\n" << QJsonDocument(resp).toJson(QJsonDocument::Indented) << "\n";
+        << path << " <== Content-Type: " << util::recortar(contentType, 64)
+        << " ==> [" << (int)status << "]";
+
+    return QHttpServerResponse(
+        makeErrorResponse("Unsupported media type",
+                          "Se espera Content-Type: application/json",
+                          (int)status),
+        status);
+  }
+
+  return std::nullopt;
+}
 
-    return QHttpServerResponse(resp, status);
+
+void handleIndex(QHttpServer &httpServer, QHttpServerRequest::Method method,
+                 QByteArray path) {
+  httpServer.route(path, method, []() {
+    return "<head><meta charset=\"UTF-8\"></head><h1>Simulador "
+           "POS</h1><p>Basado en la especificación del POS de Bancard.</p>\n";
   });
 }
 
-void handleVentaQr(QHttpServer &httpServer, QHttpServerRequest::Method method,
-                   const QByteArray &path) {
-  httpServer.route(path, method, [](const QHttpServerRequest &request) {
+/*
+ * Catálogos de emisores y billeteras. Los usan los listados de /issuers/ y
+ * /billeteras/ y el dataset de cuentas sintéticas.
+ */
+namespace catalogo {
+
+struct Emisor {
+  const char *marca;
+  const char *tipo;
+  const char *issuerId;
+};
+
+struct Billetera {
+  const char *marca;
+  const char *codigo;
+  const char *issuerId;
+};
+
+static const Emisor issuers[] = {
+    {"CABAL", "Crédito", "CB"},
+    {"CREDIFIELCO", "Crédito", "CC"},
+    {"CARTA CLAVE", "Crédito", "CL"},
+    {"PANAL", "Crédito", "CP"},
+    {"DINERS", "Crédito", "DC"},
+    {"INFONET", "Débito", "ID"},
+    {"MASTERCARD", "Crédito", "MC"},
+    {"MASTERCARD", "Débito", "MD"},
+    {"CREDICARD", "Crédito", "PC"},
+    {"UNICA", "Débito", "UD"},
+    {"VISA", "Crédito", "VC"},
+    {"VISA", "Débito", "VD"},
+    {"TARJETA DEBITO", "Débito", "TD"},
+    {"TARJETA CREDITO", "Crédito", "TC"},
+    {"DEBITO EN CUENTA", "Débito", "CD"},
+    {"AMERICAN EXPRESS", "Crédito", "AC"},
+    {"BANCARD", "Crédito", "BC"},
+};
+
+static const Billetera billeteras[] = {
+    {"ZIMPLE", "ZIM", "ZM"},
+    {"Paraguayo Japonesa", "WPJ", "PJ"},
+    {"VISION", "VBV", "VB"},
+    {"Personal-Itau", "BPI", "PI"},
+    {"Billetera Viru", "BBF", "BF"},
+};
+
+static constexpr int cantidadIssuers = int(std::size(issuers));
+static constexpr int cantidadBilleteras = int(std::size(billeteras));
+
+} // namespace catalogo
+
+/*
+ * Dataset de tarjetas y billeteras sintéticas, en un archivo mapeado en
+ * memoria con una columna por campo:
+ *
+ *   Cabecera (64 bytes)
+ *   pan:u64[n] saldo:i64[n] limite:i64[n] emisor:u8[n] nombre:u8[n]
+ *   apellido:u8[n] (relleno hasta múltiplo de 8) indice:u32[capacidad]
+ *
+ * Las primeras `tarjetas` filas son tarjetas (emisor indexa
+ * catalogo::issuers) y el resto billeteras (emisor indexa
+ * catalogo::billeteras). El índice es una tabla hash de direccionamiento
+ * abierto PAN -> fila+1, así la búsqueda es O(1).
+ *
+ * El saldo se debita con compare-and-swap directamente sobre el mapeo, sin
+ * locks; como el mapeo es compartido, los saldos quedan en el archivo.
+ */
+namespace datos {
+
+struct Cabecera {
+  char magia[8];
+  quint32 version;
+  quint32 reservado;
+  quint64 tarjetas;
+  quint64 billeteras;
+  quint64 capacidad;
+  quint64 libre[3];
+};
+static_assert(sizeof(Cabecera) == 64);
+static_assert(sizeof(std::atomic<qint64>) == sizeof(qint64) &&
+              std::atomic<qint64>::is_always_lock_free);
+
+static constexpr char magia[8] = {'S', 'P', 'O', 'S', 'D', 'A', 'T', '1'};
+static constexpr quint32 version = 1;
+
+// Números de billetera posibles (celulares 0959 de ocho dígitos).
+static constexpr quint64 espacioBilleteras = 100000000;
+
+static const char *const nombres[] = {
+    "MARIA",  "JOSE",    "JUAN",   "ANA",     "CARLOS", "ROSA",    "LUIS",
+    "CARMEN", "JORGE",   "LAURA",  "MIGUEL",  "SOFIA",  "DIEGO",   "PAOLA",
+    "RAMON",  "GLORIA",  "HUGO",   "NATALIA", "OSCAR",  "ROCIO",   "VICTOR",
+    "ANDREA", "RAUL",    "SANDRA", "PEDRO",   "MONICA", "MARCOS",  "CLAUDIA",
+    "ANTONIO", "LOURDES", "FERNANDO", "LIZ"};
+
+static const char *const apellidos[] = {
+    "GONZALEZ", "BENITEZ",  "MARTINEZ", "LOPEZ",     "GIMENEZ", "VERA",
+    "DUARTE",   "RAMIREZ",  "FERNANDEZ", "ACOSTA",   "ROJAS",   "BAEZ",
+    "CACERES",  "FRANCO",   "ORTIZ",    "CABALLERO", "VILLALBA", "AYALA",
+    "SANCHEZ",  "ROMERO",   "ALVAREZ",  "OVIEDO",    "ESPINOLA", "MEDINA",
+    "RIOS",     "CANTERO",  "AQUINO",   "AREVALOS",  "SOSA",    "NUÑEZ",
+    "ARMOA",    "ESCOBAR"};
+
+struct Columnas {
+  quint64 *pan = nullptr;
+  std::atomic<qint64> *saldo = nullptr;
+  qint64 *limite = nullptr;
+  quint8 *emisor = nullptr;
+  quint8 *nombre = nullptr;
+  quint8 *apellido = nullptr;
+  quint32 *indice = nullptr;
+};
+
+struct Cuenta {
+  quint64 pan;
+  bool billetera;
+  const char *marca;
+  const char *tipo;
+  const char *issuerId;
+  QString titular;
+};
+
+struct Debito {
+  bool ok;
+  QString motivo;
+  qint64 saldo;
+};
+
+static QFile *archivo = nullptr;
+static Cabecera *cabecera = nullptr;
+static Columnas columnas;
+
+bool cargado() { return cabecera != nullptr; }
+
+static quint64 filas(const Cabecera &c) { return c.tarjetas + c.billeteras; }
+
+static qint64 tamanio(quint64 n, quint64 capacidad) {
+  const qint64 columnasFijas = sizeof(Cabecera) + n * (8 + 8 + 8 + 1 + 1 + 1);
+  return ((columnasFijas + 7) & ~qint64(7)) + capacidad * sizeof(quint32);
+}
 
-      const std::optional<QJsonObject> json =
-          byteArrayToJsonObject(request.body());
+static void mapear(uchar *base) {
+  cabecera = reinterpret_cast<Cabecera *>(base);
+  const auto n = filas(*cabecera);
+
+  auto *p = base + sizeof(Cabecera);
+  columnas.pan = reinterpret_cast<quint64 *>(p);
+  p += n * sizeof(quint64);
+  columnas.saldo = reinterpret_cast<std::atomic<qint64> *>(p);
+  p += n * sizeof(qint64);
+  columnas.limite = reinterpret_cast<qint64 *>(p);
+  p += n * sizeof(qint64);
+  columnas.emisor = p;
+  p += n;
+  columnas.nombre = p;
+  p += n;
+  columnas.apellido = p;
+  p += n;
+  p = base + ((p - base + 7) & ~qintptr(7));
+  columnas.indice = reinterpret_cast<quint32 *>(p);
+}
 
-      auto status =  QHttpServerResponder::StatusCode::Ok;
+/// Mezcla de splitmix64, para repartir los PAN en el índice.
+static quint64 mezclar(quint64 x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
 
-      if (!json){
-          status =  QHttpServerResponder::StatusCode::BadRequest;
-          auto eResp = makeErrorResponse("Bad request", "JSON inválido", (int) status);
+std::optional<quint64> buscar(quint64 pan) {
+  if (!cargado())
+    return std::nullopt;
 
-                       qDebug().noquote().nospace()
-                       << request.url().toDisplayString(QUrl::RemoveQuery) << " <==\n"
-                       << request.body() << Qt::endl
-                       << "==> [" << (int)status << "]\n"
-                       << QJsonDocument(eResp).toJson(QJsonDocument::Indented) << "\n";
+  const auto mascara = cabecera->capacidad - 1;
+  for (auto i = mezclar(pan) & mascara;; i = (i + 1) & mascara) {
+    const auto v = columnas.indice[i];
+    if (!v)
+      return std::nullopt;
+    if (columnas.pan[v - 1] == pan)
+      return v - 1;
+  }
+}
 
-          return QHttpServerResponse(eResp, status);
-      }
+/// Inserta la fila en el índice; devuelve false si el PAN ya existía.
+static bool indexar(quint64 fila) {
+  const auto pan = columnas.pan[fila];
+  const auto mascara = cabecera->capacidad - 1;
+  for (auto i = mezclar(pan) & mascara;; i = (i + 1) & mascara) {
+    const auto v = columnas.indice[i];
+    if (!v) {
+      columnas.indice[i] = quint32(fila + 1);
+      return true;
+    }
+    if (columnas.pan[v - 1] == pan)
+      return false;
+  }
+}
 
-      auto req = json.value();
+/// PAN de 16 dígitos con el dígito verificador de Luhn.
+static quint64 panConLuhn(quint64 cuerpo) {
+  int suma = 0;
+  auto resto = cuerpo;
+  for (int i = 0; i < 15; ++i, resto /= 10) {
+    int d = int(resto % 10);
+    if (i % 2 == 0) {
+      d *= 2;
+      if (d > 9)
+        d -= 9;
+    }
+    suma += d;
+  }
+  return cuerpo * 10 + (10 - suma % 10) % 10;
+}
 
-      auto facturaNro = req.value("facturaNro").toInteger();
-      auto monto = req.value("monto").toInteger();
+/*
+ * Revisa una vez, al abrir, que los bytes que cuenta() usa como índices de
+ * los catálogos estén en rango y que el índice apunte a filas existentes,
+ * para no leer fuera de las tablas con un archivo corrupto o editado.
+ */
+static bool columnasValidas() {
+  const auto n = filas(*cabecera);
+  for (quint64 fila = 0; fila < n; ++fila) {
+    const auto emisores = fila >= cabecera->tarjetas
+                              ? catalogo::cantidadBilleteras
+                              : catalogo::cantidadIssuers;
+    if (columnas.emisor[fila] >= emisores ||
+        columnas.nombre[fila] >= std::size(nombres) ||
+        columnas.apellido[fila] >= std::size(apellidos))
+      return false;
+  }
+  for (quint64 i = 0; i < cabecera->capacidad; ++i)
+    if (columnas.indice[i] > n)
+      return false;
+  return true;
+}
 
-      if (monto < 10 || facturaNro < 10) {
-          status =  QHttpServerResponder::StatusCode::NotAcceptable;
-          auto eResp =
-              makeErrorResponse("Bad request", "NÚMERO DE FACTURA o MONTO inválido", (int) status);
+static void cerrarArchivo() {
+  delete archivo; // también quita el mapeo
 
-              qDebug().noquote().nospace()
-              << request.url().toDisplayString(QUrl::RemoveQuery) << " <==\n"
-              << QJsonDocument(req).toJson(QJsonDocument::JsonFormat::Indented)
-              << "==> [" << (int) status << "]\n"
-              << QJsonDocument(eResp).toJson(QJsonDocument::Indented) << "\n";
+  archivo = nullptr;
+  cabecera = nullptr;
+  columnas = {};
+}
 
-          return QHttpServerResponse(eResp, status);
-      }
+bool abrir(const QString &ruta) {
+  cerrarArchivo();
 
-      /*
-     * Espero que los errores transaccionales
-     * no se respondan en este nivel de abstracción
-     * ESTO ES SOLO UNA PRUEBA
-     */
-      if (monto > 1000000) {
-          status =  QHttpServerResponder::StatusCode::BadRequest;
-          auto eResp =
-              makeErrorResponse("Bad request", "Saldo insuficiente", (int) status);
-
-          qDebug().noquote().nospace()
-              << request.url().toDisplayString(QUrl::RemoveQuery) << " <==\n"
-              << QJsonDocument(req).toJson(QJsonDocument::JsonFormat::Indented)
-              << "==> [" << (int) status << "]\n"
-              << QJsonDocument(eResp).toJson(QJsonDocument::Indented) << "\n";
-
-          return QHttpServerResponse(eResp, status);
-      }
+  archivo = new QFile(ruta);
+  if (!archivo->open(QIODevice::ReadWrite)) {
+    qWarning().noquote() << "No se pudo abrir el dataset" << ruta << ":"
+                         << archivo->errorString();
+    cerrarArchivo();
+    return false;
+  }
 
-      QJsonObject resp;
-      resp["codigoAutorizacion"] = QString::number(util::randomInt(1,999999));
-      resp["codigoComercio"] = QString::number(util::randomLong(1,9999999999));
-      resp["issuerId"] = "ZZ";
-      resp["mensajeDisplay"] = "APROBADA (QR)";
-      resp["montoVuelto"] = util::randomInt(0, 500000);
-      resp["saldo"] = util::randomInt(1, 500000000);
-      resp["nombreCliente"] = "Nombre de Alguien";
-      resp["pan"] = util::randomInt(1,9999);
-      resp["nombreTarjeta"] = "VISA ZZZZZZZ";
-      resp["nroBoleta"] = QString::number(util::randomLong(1,9999999999));
+  const auto tam = archivo->size();
+  auto *base = tam >= qint64(sizeof(Cabecera)) ? archivo->map(0, tam) : nullptr;
+  const auto *c = reinterpret_cast<const Cabecera *>(base);
+
+  // buscar() usa la capacidad como máscara y necesita huecos libres para
+  // terminar: tiene que ser potencia de dos y mayor que la cantidad de filas.
+  if (!base || memcmp(c->magia, magia, sizeof magia) != 0 ||
+      c->version != version || filas(*c) >= c->capacidad ||
+      c->capacidad > std::numeric_limits<quint32>::max() ||
+      (c->capacidad & (c->capacidad - 1)) != 0 ||
+      tamanio(filas(*c), c->capacidad) != tam) {
+    qWarning().noquote() << "El dataset" << ruta << "no es válido";
+    cerrarArchivo();
+    return false;
+  }
 
-      qDebug().noquote().nospace()
-          << request.url().toDisplayString(QUrl::RemoveQuery) << " <==\n"
-          << QJsonDocument(req).toJson(QJsonDocument::JsonFormat::Indented)
-          << "==> [" << (int) status << "]\n" << QJsonDocument(resp).toJson(QJsonDocument::Indented) << "\n";
+  mapear(base);
+  if (!columnasValidas()) {
+    qWarning().noquote() << "El dataset" << ruta << "tiene filas inválidas";
+    cerrarArchivo();
+    return false;
+  }
 
-      return QHttpServerResponse(resp, status);
-  });
+  qInfo().noquote().nospace() << "Dataset " << ruta << ": "
+                              << cabecera->tarjetas << " tarjetas, "
+                              << cabecera->billeteras << " billeteras";
+  return true;
 }
 
-void handleVentaCanje(QHttpServer &httpServer,
-                      QHttpServerRequest::Method method,
-                      const QByteArray &path) {
-  httpServer.route(path, method, [](const QHttpServerRequest &request) {
-      const std::optional<QJsonObject> json =
-          byteArrayToJsonObject(request.body());
+bool generar(const QString &ruta, quint64 cantidad, quint32 semilla) {
+  cerrarArchivo();
 
-      auto status =  QHttpServerResponder::StatusCode::Ok;
+  const quint64 tarjetas = cantidad - cantidad / 10;
+  const quint64 billeterasTotal = cantidad / 10;
 
-      if (!json){
-          status =  QHttpServerResponder::StatusCode::BadRequest;
-          auto eResp = makeErrorResponse("Bad request", "JSON inválido", (int) status);
+  // Los números de billetera se sortean sin repetir: con más de la mitad del
+  // espacio ocupado el sorteo se vuelve lento y, lleno, no termina.
+  if (cantidad == 0 || cantidad >= std::numeric_limits<quint32>::max() / 2 ||
+      billeterasTotal > espacioBilleteras / 2) {
+    qWarning().noquote() << "Cantidad de cuentas inválida:" << cantidad;
+    return false;
+  }
+  const quint64 capacidad = qNextPowerOfTwo(2 * cantidad);
+
+  archivo = new QFile(ruta);
+  const auto tam = tamanio(cantidad, capacidad);
+  if (!archivo->open(QIODevice::ReadWrite | QIODevice::Truncate) ||
+      !archivo->resize(tam)) {
+    qWarning().noquote() << "No se pudo crear el dataset" << ruta << ":"
+                         << archivo->errorString();
+    cerrarArchivo();
+    return false;
+  }
 
-                       qDebug().noquote().nospace()
-                       << request.url().toDisplayString(QUrl::RemoveQuery) << " <==\n"
-                       << request.body() << Qt::endl
-                       << "==> [" << (int)status << "]\n"
-                       << QJsonDocument(eResp).toJson(QJsonDocument::Indented) << "\n";
+  auto *base = archivo->map(0, tam);
+  if (!base) {
+    qWarning().noquote() << "No se pudo mapear el dataset" << ruta;
+    cerrarArchivo();
+    return false;
+  }
 
-          return QHttpServerResponse(eResp, status);
-      }
+  auto *c = reinterpret_cast<Cabecera *>(base);
+  memcpy(c->magia, magia, sizeof magia);
+  c->version = version;
+  c->tarjetas = tarjetas;
+  c->billeteras = billeterasTotal;
+  c->capacidad = capacidad;
+  mapear(base);
+
+  QRandomGenerator rng(semilla);
+
+  for (quint64 fila = 0; fila < cantidad; ++fila) {
+    const bool billetera = fila >= tarjetas;
+
+    do {
+      // Tarjetas: 16 dígitos con Luhn. Billeteras: un número de celular.
+      columnas.pan[fila] =
+          billetera ? 595900000000ULL + rng.bounded(espacioBilleteras)
+                    : panConLuhn(400000000000000ULL +
+                                 rng.generate64() % 500000000000000ULL);
+    } while (!indexar(fila));
+
+    columnas.emisor[fila] = quint8(rng.bounded(
+        billetera ? catalogo::cantidadBilleteras : catalogo::cantidadIssuers));
+    columnas.nombre[fila] = quint8(rng.bounded(int(std::size(nombres))));
+    columnas.apellido[fila] = quint8(rng.bounded(int(std::size(apellidos))));
+    columnas.saldo[fila].store(100000 + rng.bounded(20000000),
+                               std::memory_order_relaxed);
+    columnas.limite[fila] = 500000 + rng.bounded(4500000);
+  }
 
-      auto req = json.value();
+  qInfo().noquote().nospace() << "Dataset generado en " << ruta << ": "
+                              << tarjetas << " tarjetas, " << billeterasTotal
+                              << " billeteras";
+  return true;
+}
 
-      auto facturaNro = req.value("facturaNro").toInteger();
-      auto monto = req.value("monto").toInteger();
+void cerrar() { cerrarArchivo(); }
+
+Cuenta cuenta(quint64 fila) {
+  Cuenta c;
+  c.pan = columnas.pan[fila];
+  c.billetera = fila >= cabecera->tarjetas;
+  if (c.billetera) {
+    const auto &b = catalogo::billeteras[columnas.emisor[fila]];
+    c.marca = b.marca;
+    c.tipo = "Billetera";
+    c.issuerId = b.issuerId;
+  } else {
+    const auto &e = catalogo::issuers[columnas.emisor[fila]];
+    c.marca = e.marca;
+    c.tipo = e.tipo;
+    c.issuerId = e.issuerId;
+  }
+  c.titular = QString::fromUtf8(nombres[columnas.nombre[fila]]) + u' ' +
+              QString::fromUtf8(apellidos[columnas.apellido[fila]]);
+  return c;
+}
 
-      if (monto < 10 || facturaNro < 10) {
-          status =  QHttpServerResponder::StatusCode::NotAcceptable;
-          auto eResp =
-              makeErrorResponse("Bad request", "NÚMERO DE FACTURA o MONTO inválido", (int) status);
+/*
+ * Elige la cuenta de una solicitud: por PAN si lo trae y, si no, una fija
+ * según la factura (o el NSU/BIN en descuento), de tarjetas o de billeteras
+ * según la operación.
+ */
+std::optional<quint64> elegir(quint64 pan, quint64 clave, bool billetera) {
+  if (pan)
+    return buscar(pan);
+
+  const auto inicio = billetera ? cabecera->tarjetas : 0;
+  const auto cantidad = billetera ? cabecera->billeteras : cabecera->tarjetas;
+  if (!cantidad)
+    return std::nullopt;
+  return inicio + mezclar(clave) % cantidad;
+}
 
-              qDebug().noquote().nospace()
-              << request.url().toDisplayString(QUrl::RemoveQuery) << " <==\n"
-              << QJsonDocument(req).toJson(QJsonDocument::JsonFormat::Indented)
-              << "==> [" << (int) status << "]\n"
-              << QJsonDocument(eResp).toJson(QJsonDocument::Indented) << "\n";
+Debito debitar(quint64 fila, qint64 monto) {
+  auto &saldo = columnas.saldo[fila];
+  auto actual = saldo.load(std::memory_order_relaxed);
 
-          return QHttpServerResponse(eResp, status);
-      }
+  if (monto > columnas.limite[fila])
+    return {false, "Monto excede el límite", actual};
 
-      /*
-     * Espero que los errores transaccionales
-     * no se respondan en este nivel de abstracción
-     * ESTO ES SOLO UNA PRUEBA
-     */
-      if (monto > 1000000) {
-          status =  QHttpServerResponder::StatusCode::BadRequest;
-          auto eResp =
-              makeErrorResponse("Bad request", "Saldo insuficiente", (int) status);
-
-          qDebug().noquote().nospace()
-              << request.url().toDisplayString(QUrl::RemoveQuery) << " <==\n"
-              << QJsonDocument(req).toJson(QJsonDocument::JsonFormat::Indented)
-              << "==> [" << (int) status << "]\n"
-              << QJsonDocument(eResp).toJson(QJsonDocument::Indented) << "\n";
-
-          return QHttpServerResponse(eResp, status);
-      }
+  do {
+    if (actual < monto)
+      return {false, "Saldo insuficiente", actual};
+  } while (!saldo.compare_exchange_weak(actual, actual - monto,
+                                        std::memory_order_acq_rel,
+                                        std::memory_order_relaxed));
 
-      QJsonObject resp;
-      resp["codigoAutorizacion"] = QString::number(util::randomInt(1,999999));
-      resp["codigoComercio"] = QString::number(util::randomLong(1,9999999999));
-      resp["issuerId"] = "ZZ";
-      resp["mensajeDisplay"] = "APROBADA (CANJE)";
-      resp["montoVuelto"] = util::randomInt(0, 500000);
-      resp["saldo"] = util::randomInt(1, 500000000);
-      resp["nombreCliente"] = "Nombre de Alguien";
-      resp["pan"] = util::randomInt(1,9999);
-      resp["nombreTarjeta"] = "VISA ZZZZZZZ";
-      resp["nroBoleta"] = QString::number(util::randomLong(1,9999999999));
+  return {true, {}, actual - monto};
+}
 
-      qDebug().noquote().nospace()
-          << request.url().toDisplayString(QUrl::RemoveQuery) << " <==\n"
-          << QJsonDocument(req).toJson(QJsonDocument::JsonFormat::Indented)
-          << "==> [" << (int) status << "]\n" << QJsonDocument(resp).toJson(QJsonDocument::Indented) << "\n";
+} // namespace datos
 
-      return QHttpServerResponse(resp, status);
-  });
+/*
+ * Transacciones aprobadas y cierre de lote.
+ *
+ * Cada transacción se agrega a un registro global de solo-agregado, en
+ * bloques que se reservan sin locks; la posición en el registro es su número
+ * de secuencia y sirve de cursor para listarlas por páginas.
+ *
+ * Los totales por emisor y tipo de pago se mantienen a medida que llegan, en
+ * una tabla por hilo (cada hilo solo escribe la suya). Cada transacción lleva
+ * el número de su lote y suma en la tabla de ese lote; el cierre pasa al lote
+ * siguiente, espera a que terminen los registros del cerrado y suma sus
+ * tablas, así que no recorre las transacciones y los totales coinciden con el
+ * listado.
+ */
+namespace lote {
+
+static const char *const nombresTipo[] = {"credito", "debito",    "qr",
+                                          "canje",   "billetera", "descuento"};
+
+// 0: emisor desconocido ("ZZ"), después los issuers y las billeteras.
+static constexpr int cantidadEmisores =
+    1 + catalogo::cantidadIssuers + catalogo::cantidadBilleteras;
+
+struct Transaccion {
+  qint64 fecha;
+  qint64 monto;
+  qint64 facturaNro;
+  quint32 lote;
+  quint32 autorizacion;
+  quint16 pan;
+  quint8 tipo;
+  quint8 emisor;
+  std::atomic<bool> lista;
+};
+
+static constexpr int bitsBloque = 16;
+static constexpr quint64 tamBloque = 1 << bitsBloque;
+static constexpr quint64 maxBloques = 1 << 16;
+
+struct Bloque {
+  Transaccion t[tamBloque];
+};
+
+struct Totales {
+  // Lote que el hilo está registrando, o 0.
+  std::atomic<quint32> registrando;
+  // Por paridad del lote: el abierto y el que se está cerrando.
+  std::atomic<quint64> cantidad[2][cantidadEmisores][CantidadTipos];
+  std::atomic<qint64> monto[2][cantidadEmisores][CantidadTipos];
+};
+
+/// Rango de secuencias del lote; puede incluir algunas de los vecinos.
+struct Cierre {
+  quint64 desde;
+  quint64 hasta;
+};
+
+/// Venta con tarjeta aprobada que espera su descuento.
+struct Venta {
+  Tipo tipo;
+  qint64 facturaNro;
+};
+
+// Ventas sin descuento que se recuerdan; las más viejas se olvidan.
+static constexpr int maxVentasAbiertas = 1 << 20;
+
+static std::atomic<Bloque *> bloques[maxBloques];
+static std::atomic<quint64> siguiente{0};
+static std::atomic<quint32> abierto{1}; // número del lote abierto
+
+static QMutex mutex; // protege totalesPorHilo, inicioAbierto y cierres
+static QList<Totales *> totalesPorHilo;
+static quint64 inicioAbierto = 0;
+static QList<Cierre> cierres;
+
+static QMutex mutexVentas; // protege ventas
+static QCache<QString, Venta> ventas(maxVentasAbiertas);
+
+static int indiceEmisor(const QString &issuerId) {
+  static const QHash<QString, int> indices = [] {
+    QHash<QString, int> h;
+    int i = 1;
+    for (const auto &e : catalogo::issuers)
+      h.insert(e.issuerId, i++);
+    for (const auto &b : catalogo::billeteras)
+      h.insert(b.issuerId, i++);
+    return h;
+  }();
+  return indices.value(issuerId, 0);
 }
 
-void handleVentaBilletera(QHttpServer &httpServer,
-                          QHttpServerRequest::Method method,
-                          const QByteArray &path) {
-  httpServer.route(path, method, [](const QHttpServerRequest &request) {
-      const std::optional<QJsonObject> json =
-          byteArrayToJsonObject(request.body());
-
-      auto status =  QHttpServerResponder::StatusCode::Ok;
+static QString issuerId(int emisor) {
+  if (emisor <= 0)
+    return "ZZ";
+  if (emisor <= catalogo::cantidadIssuers)
+    return catalogo::issuers[emisor - 1].issuerId;
+  return catalogo::billeteras[emisor - 1 - catalogo::cantidadIssuers].issuerId;
+}
 
-      if (!json){
-          status =  QHttpServerResponder::StatusCode::BadRequest;
-          auto eResp = makeErrorResponse("Bad request", "JSON inválido", (int) status);
+static Totales &totalesDelHilo() {
+  static thread_local Totales *propios = nullptr;
+  if (!propios) {
+    propios = new Totales();
+    QMutexLocker lock(&mutex);
+    totalesPorHilo << propios;
+  }
+  return *propios;
+}
 
-                       qDebug().noquote().nospace()
-                       << request.url().toDisplayString(QUrl::RemoveQuery) << " <==\n"
-                       << request.body() << Qt::endl
-                       << "==> [" << (int)status << "]\n"
-                       << QJsonDocument(eResp).toJson(QJsonDocument::Indented) << "\n";
+static Bloque *bloque(quint64 n) {
+  auto *b = bloques[n].load(std::memory_order_acquire);
+  if (b)
+    return b;
 
-          return QHttpServerResponse(eResp, status);
-      }
+  auto *nuevo = new Bloque();
+  if (bloques[n].compare_exchange_strong(b, nuevo, std::memory_order_acq_rel))
+    return nuevo;
+  delete nuevo;
+  return b;
+}
 
-      auto req = json.value();
+void registrar(Tipo tipo, const QString &issuer, qint64 monto,
+               qint64 facturaNro, int pan, quint32 autorizacion) {
+  const auto emisor = indiceEmisor(issuer);
+  auto &totales = totalesDelHilo();
+
+  // Anuncia el lote antes de usarlo; si justo se cerró, pasa al siguiente.
+  quint32 numero;
+  do {
+    numero = abierto.load();
+    totales.registrando.store(numero);
+  } while (abierto.load() != numero);
+
+  const auto secuencia = siguiente.fetch_add(1, std::memory_order_relaxed);
+  if ((secuencia >> bitsBloque) < maxBloques) { // lleno: solo los totales
+    auto &t = bloque(secuencia >> bitsBloque)->t[secuencia & (tamBloque - 1)];
+    t.fecha = tiempo::ahoraMs();
+    t.monto = monto;
+    t.facturaNro = facturaNro;
+    t.lote = numero;
+    t.autorizacion = autorizacion;
+    t.pan = quint16(pan);
+    t.tipo = tipo;
+    t.emisor = quint8(emisor);
+    t.lista.store(true, std::memory_order_release);
+  }
 
-      auto facturaNro = req.value("facturaNro").toInteger();
-      auto monto = req.value("monto").toInteger();
+  const auto paridad = numero & 1;
+  totales.cantidad[paridad][emisor][tipo].fetch_add(1,
+                                                    std::memory_order_relaxed);
+  totales.monto[paridad][emisor][tipo].fetch_add(monto,
+                                                 std::memory_order_relaxed);
+  totales.registrando.store(0, std::memory_order_release);
+}
 
-      if (monto < 10 || facturaNro < 10) {
-          status =  QHttpServerResponder::StatusCode::NotAcceptable;
-          auto eResp =
-              makeErrorResponse("Bad request", "NÚMERO DE FACTURA o MONTO inválido", (int) status);
+/// Recuerda una venta con tarjeta hasta que llegue su descuento.
+void abrirVenta(const QString &nsuBin, Tipo tipo, qint64 facturaNro) {
+  QMutexLocker lock(&mutexVentas);
+  ventas.insert(nsuBin, new Venta{tipo, facturaNro});
+}
 
-              qDebug().noquote().nospace()
-              << request.url().toDisplayString(QUrl::RemoveQuery) << " <==\n"
-              << QJsonDocument(req).toJson(QJsonDocument::JsonFormat::Indented)
-              << "==> [" << (int) status << "]\n"
-              << QJsonDocument(eResp).toJson(QJsonDocument::Indented) << "\n";
+/// Devuelve y olvida la venta del NSU/BIN, si se conoce.
+std::optional<Venta> tomarVenta(const QString &nsuBin) {
+  QMutexLocker lock(&mutexVentas);
+  const std::unique_ptr<Venta> venta(ventas.take(nsuBin));
+  if (!venta)
+    return std::nullopt;
+  return *venta;
+}
 
-          return QHttpServerResponse(eResp, status);
+/// Cierra el lote actual y devuelve sus totales.
+QJsonObject cerrar() {
+  QMutexLocker lock(&mutex);
+
+  // Las transacciones del lote nuevo toman secuencias desde inicioSiguiente;
+  // las del cerrado, todas antes de hasta.
+  const auto numero = abierto.load();
+  const auto inicioSiguiente = siguiente.load();
+  abierto.store(numero + 1);
+  for (const auto *totales : std::as_const(totalesPorHilo))
+    while (totales->registrando.load() == numero)
+      QThread::yieldCurrentThread();
+
+  const auto desde = inicioAbierto;
+  const auto hasta = siguiente.load(std::memory_order_acquire);
+  inicioAbierto = inicioSiguiente;
+  const auto paridad = numero & 1;
+
+  quint64 cantidadTotal = 0;
+  qint64 montoTotal = 0;
+  quint64 cantidadPorTipo[CantidadTipos] = {};
+  qint64 montoPorTipo[CantidadTipos] = {};
+  QJsonArray porEmisor;
+
+  for (int e = 0; e < cantidadEmisores; ++e) {
+    for (int t = 0; t < CantidadTipos; ++t) {
+      // Nadie más escribe en esta paridad hasta el próximo cierre.
+      quint64 cantidadLote = 0;
+      qint64 montoLote = 0;
+      for (auto *totales : std::as_const(totalesPorHilo)) {
+        cantidadLote += totales->cantidad[paridad][e][t].exchange(
+            0, std::memory_order_relaxed);
+        montoLote += totales->monto[paridad][e][t].exchange(
+            0, std::memory_order_relaxed);
       }
 
-      /*
-     * Espero que los errores transaccionales
-     * no se respondan en este nivel de abstracción
-     * ESTO ES SOLO UNA PRUEBA
-     */
-      if (monto > 1000000) {
-          status =  QHttpServerResponder::StatusCode::BadRequest;
-          auto eResp =
-              makeErrorResponse("Bad request", "Saldo insuficiente", (int) status);
-
-          qDebug().noquote().nospace()
-              << request.url().toDisplayString(QUrl::RemoveQuery) << " <==\n"
-              << QJsonDocument(req).toJson(QJsonDocument::JsonFormat::Indented)
-              << "==> [" << (int) status << "]\n"
-              << QJsonDocument(eResp).toJson(QJsonDocument::Indented) << "\n";
-
-          return QHttpServerResponse(eResp, status);
-      }
+      if (!cantidadLote)
+        continue;
+
+      cantidadTotal += cantidadLote;
+      montoTotal += montoLote;
+      cantidadPorTipo[t] += cantidadLote;
+      montoPorTipo[t] += montoLote;
+      porEmisor << QJsonObject{{"issuerId", issuerId(e)},
+                               {"tipo", nombresTipo[t]},
+                               {"cantidad", qint64(cantidadLote)},
+                               {"monto", montoLote}};
+    }
+  }
 
-      QJsonObject resp;
-      resp["codigoAutorizacion"] = QString::number(util::randomInt(1,999999));
-      resp["codigoComercio"] = QString::number(util::randomLong(1,9999999999));
-      resp["issuerId"] = "ZZ";
-      resp["mensajeDisplay"] = "APROBADA (BILLETERA)";
-      resp["montoVuelto"] = util::randomInt(0, 500000);
-      resp["saldo"] = util::randomInt(1, 500000000);
-      resp["nombreCliente"] = "Nombre de Alguien";
-      resp["pan"] = util::randomInt(1,9999);
-      resp["nombreTarjeta"] = "VISA ZZZZZZZ";
-      resp["nroBoleta"] = QString::number(util::randomLong(1,9999999999));
+  QJsonObject porTipo;
+  for (int t = 0; t < CantidadTipos; ++t)
+    porTipo[nombresTipo[t]] = QJsonObject{
+        {"cantidad", qint64(cantidadPorTipo[t])}, {"monto", montoPorTipo[t]}};
 
-      qDebug().noquote().nospace()
-          << request.url().toDisplayString(QUrl::RemoveQuery) << " <==\n"
-          << QJsonDocument(req).toJson(QJsonDocument::JsonFormat::Indented)
-          << "==> [" << (int) status << "]\n" << QJsonDocument(resp).toJson(QJsonDocument::Indented) << "\n";
+  cierres << Cierre{desde, hasta};
 
-      return QHttpServerResponse(resp, status);
-  });
+  return QJsonObject{
+      {"lote", cierres.size()},
+      {"fecha", tiempo::ahora().toString(Qt::ISODateWithMs)},
+      {"desde", qint64(desde)},
+      {"hasta", qint64(hasta)},
+      {"cantidad", qint64(cantidadTotal)},
+      {"monto", montoTotal},
+      {"porTipo", porTipo},
+      {"porEmisor", porEmisor},
+  };
+}
+
+/*
+ * Una página del listado. `numeroLote` 0 es el lote abierto; `desde` es el
+ * cursor devuelto por la página anterior (o 0 para empezar).
+ */
+std::optional<QJsonObject> listar(int numeroLote, quint64 desde,
+                                  int limite) {
+  quint32 numero = numeroLote;
+  quint64 inicio;
+  quint64 fin;
+  {
+    QMutexLocker lock(&mutex);
+    if (numeroLote < 0 || numeroLote > cierres.size())
+      return std::nullopt;
+
+    if (numeroLote == 0) {
+      numero = abierto.load();
+      inicio = inicioAbierto;
+      fin = siguiente.load(std::memory_order_acquire);
+    } else {
+      inicio = cierres[numeroLote - 1].desde;
+      fin = cierres[numeroLote - 1].hasta;
+    }
+  }
+  fin = qMin(fin, maxBloques * tamBloque);
+
+  QJsonArray transacciones;
+  auto i = qMax(inicio, desde);
+
+  for (; i < fin && transacciones.size() < limite; ++i) {
+    const auto *b = bloques[i >> bitsBloque].load(std::memory_order_acquire);
+    const Transaccion *t = b ? &b->t[i & (tamBloque - 1)] : nullptr;
+    if (!t || !t->lista.load(std::memory_order_acquire)) {
+      if (numeroLote == 0)
+        break; // todavía se está escribiendo; aparece en la próxima página
+      continue; // en un lote cerrado, es del lote siguiente
+    }
+    if (t->lote != numero)
+      continue;
+
+    transacciones << QJsonObject{
+        {"secuencia", qint64(i)},
+        {"fecha", QDateTime::fromMSecsSinceEpoch(t->fecha)
+                      .toString(Qt::ISODateWithMs)},
+        {"tipo", nombresTipo[t->tipo]},
+        {"issuerId", issuerId(t->emisor)},
+        {"monto", t->monto},
+        {"facturaNro", t->facturaNro},
+        {"pan", t->pan},
+        {"autorizacion", qint64(t->autorizacion)},
+    };
+  }
+
+  const bool hayMas = numeroLote == 0 || i < fin;
+  return QJsonObject{
+      {"lote", numeroLote},
+      {"transacciones", transacciones},
+      {"siguiente", hayMas ? QJsonValue(qint64(i)) : QJsonValue()},
+  };
+}
+
+} // namespace lote
+
+/*
+ * Escenario: latencia y fallas que cambian con el tiempo, leídas de un
+ * archivo de texto. Cada fase es un intervalo del reloj virtual, contado
+ * desde el arranque, con sus efectos:
+ *
+ *   t=0-5m: p50 200ms
+ *   t=5-7m: 30% timeouts en /pos/venta-qr, 5% errores
+ *   luego rampa 3m
+ *
+ * Las fases se separan con saltos de línea o ';', y los efectos con ','.
+ * `luego` empieza donde terminó la fase anterior y dura lo indicado (1m si
+ * no se indica). En una fase `rampa` cada solicitud toma la fase anterior
+ * con una probabilidad que baja linealmente de 1 a 0, así que los
+ * porcentajes van pasando de una fase a la otra; sin otros efectos, la
+ * rampa vuelve al comportamiento normal. Fuera de las fases los endpoints
+ * responden como siempre.
+ */
+namespace escenario {
+
+struct Falla {
+  QString ruta; // vacía: todas
+  double timeouts = 0;
+  double errores = 0;
+};
+
+struct Fase {
+  qint64 desde = 0;
+  qint64 hasta = 0;
+  qint64 p50 = -1;
+  bool rampa = false;
+  QList<Falla> fallas;
+  QStringList texto;
+};
+
+enum class Efecto { Ninguno, Timeout, Error };
+
+struct Decision {
+  Efecto efecto = Efecto::Ninguno;
+  qint64 delay = -1; // -1: el del endpoint
+};
+
+/// Cuánto tarda en responder una solicitud a la que le toca timeout.
+static constexpr qint64 timeoutMs = 30000;
+static constexpr double dispersion = 0.5; // sigma de la log-normal
+
+static QList<Fase> fases;
+static qint64 inicioMs = 0;
+
+static quint32 semilla = 1;
+static thread_local std::optional<QRandomGenerator> generadorHilo;
+static std::atomic<quint64> timeouts{0};
+static std::atomic<quint64> errores{0};
+
+static const QString patronNumero = QStringLiteral("(\\d+(?:\\.\\d+)?)");
+static const QString patronUnidad = QStringLiteral("(ms|s|m|h)");
+
+static qint64 aMs(const QString &valor, const QString &unidad) {
+  const auto v = valor.toDouble();
+  if (unidad == "h")
+    return qRound64(v * 3600000);
+  if (unidad == "m")
+    return qRound64(v * 60000);
+  if (unidad == "s")
+    return qRound64(v * 1000);
+  return qRound64(v);
+}
+
+static bool agregarEfecto(Fase &fase, const QString &texto) {
+  static const QRegularExpression p50(
+      "^p50\\s*" + patronNumero + "\\s*" + patronUnidad + "?$");
+  static const QRegularExpression falla(
+      "^" + patronNumero +
+      "\\s*%\\s*(timeouts?|errores|errors?)(?:\\s+(?:en|on)\\s+(\\S+))?$");
+  static const QRegularExpression rampa(
+      "^(?:rampa|ramp)(?:\\s+(?:back|de vuelta))?$");
+
+  const auto efecto = texto.simplified().toLower();
+  if (efecto.isEmpty())
+    return true;
+
+  if (const auto m = p50.match(efecto); m.hasMatch()) {
+    fase.p50 = aMs(m.captured(1), m.captured(2));
+    return true;
+  }
+  if (const auto m = falla.match(efecto); m.hasMatch()) {
+    Falla f;
+    f.ruta = m.captured(3);
+    if (m.captured(2).startsWith('t'))
+      f.timeouts = m.captured(1).toDouble();
+    else
+      f.errores = m.captured(1).toDouble();
+    fase.fallas << f;
+    return true;
+  }
+  if (rampa.match(efecto).hasMatch()) {
+    fase.rampa = true;
+    return true;
+  }
+  return false;
+}
+
+static bool parsear(const QString &contenido) {
+  static const QRegularExpression intervalo(
+      "^(?:t\\s*=\\s*)?" + patronNumero + "\\s*" + patronUnidad +
+      "?\\s*[-–—]\\s*" + patronNumero + "\\s*" + patronUnidad +
+      "\\s*:(.*)$");
+  static const QRegularExpression luego("^(?:luego|then)\\b(.*)$");
+  static const QRegularExpression duracion(
+      "\\s+" + patronNumero + "\\s*" + patronUnidad + "$");
+
+  const auto lineas = contenido.split('\n');
+  for (int n = 0; n < lineas.size(); ++n) {
+    const auto linea = lineas[n].section('#', 0, 0);
+
+    for (const auto &parte : linea.split(';')) {
+      const auto texto = parte.trimmed();
+      if (texto.isEmpty())
+        continue;
+
+      QString efectos;
+      if (const auto m = intervalo.match(texto.toLower()); m.hasMatch()) {
+        Fase fase;
+        const auto unidadFin = m.captured(4);
+        fase.desde = aMs(m.captured(1), m.captured(2).isEmpty()
+                                            ? unidadFin
+                                            : m.captured(2));
+        fase.hasta = aMs(m.captured(3), unidadFin);
+        fases << fase;
+        efectos = m.captured(5);
+      } else if (const auto m = luego.match(texto.toLower()); m.hasMatch()) {
+        Fase fase;
+        fase.desde = fases.isEmpty() ? 0 : fases.last().hasta;
+        efectos = m.captured(1);
+        qint64 largo = 60000;
+        if (const auto d = duracion.match(efectos); d.hasMatch()) {
+          largo = aMs(d.captured(1), d.captured(2));
+          efectos.truncate(d.capturedStart());
+        }
+        fase.hasta = fase.desde + largo;
+        fases << fase;
+      } else if (!fases.isEmpty()) {
+        efectos = texto; // más efectos de la fase anterior
+      } else {
+        qWarning().noquote().nospace()
+            << "Escenario, línea " << n + 1 << ": falta el intervalo";
+        return false;
+      }
+
+      auto &fase = fases.last();
+      fase.texto << texto;
+      for (const auto &efecto : efectos.split(',')) {
+        if (!agregarEfecto(fase, efecto)) {
+          qWarning().noquote().nospace() << "Escenario, línea " << n + 1
+                                         << ": efecto desconocido: "
+                                         << efecto.trimmed();
+          return false;
+        }
+      }
+    }
+  }
+
+  for (int i = 0; i < fases.size(); ++i) {
+    const auto &fase = fases[i];
+    const auto anterior = i > 0 ? fases[i - 1].hasta : 0;
+    if (fase.hasta <= fase.desde || fase.desde < anterior) {
+      qWarning().noquote()
+          << "Escenario: fases superpuestas o vacías en"
+          << fase.texto.join("; ");
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * Cada hilo sortea con su propio generador, sembrado con la semilla del
+ * escenario y el número del hilo (0 el principal, 1..n los trabajadores
+ * binarios), así decidir() no comparte estado entre hilos.
+ */
+void sembrarHilo(quint32 hilo) {
+  const quint32 semillas[] = {semilla, hilo};
+  generadorHilo.emplace(std::begin(semillas), std::end(semillas));
+}
+
+static QRandomGenerator &generador() {
+  if (!generadorHilo)
+    sembrarHilo(0);
+  return *generadorHilo;
+}
+
+bool cargar(const QString &ruta, quint32 semilla) {
+  QFile archivo(ruta);
+  if (!archivo.open(QIODevice::ReadOnly | QIODevice::Text)) {
+    qWarning().noquote() << "No se pudo abrir el escenario" << ruta << ":"
+                         << archivo.errorString();
+    return false;
+  }
+
+  fases.clear();
+  if (!parsear(QString::fromUtf8(archivo.readAll())))
+    return false;
+
+  escenario::semilla = semilla;
+  sembrarHilo(0);
+  inicioMs = tiempo::ahoraMs();
+  qInfo().noquote() << "Escenario" << ruta << "con" << fases.size()
+                    << "fases";
+  return true;
+}
+
+static qint64 transcurrido() { return tiempo::ahoraMs() - inicioMs; }
+
+static int faseEn(qint64 t) {
+  for (int i = 0; i < fases.size(); ++i)
+    if (t >= fases[i].desde && t < fases[i].hasta)
+      return i;
+  return -1;
+}
+
+static double avanceRampa(const Fase &fase, qint64 t) {
+  return double(t - fase.desde) / double(fase.hasta - fase.desde);
+}
+
+/// Latencia con mediana `p50` y cola larga (log-normal).
+static qint64 muestra(qint64 p50) {
+  const auto u1 = 1.0 - generador().generateDouble();
+  const auto u2 = generador().generateDouble();
+  const auto z = qSqrt(-2 * qLn(u1)) * qCos(2 * M_PI * u2);
+  return qRound64(p50 * qExp(dispersion * z));
+}
+
+/// Qué le toca a una solicitud a `ruta` en la fase actual.
+Decision decidir(const char *ruta) {
+  if (fases.isEmpty())
+    return {};
+
+  const auto t = transcurrido();
+  const auto i = faseEn(t);
+  if (i < 0)
+    return {};
+
+  const Fase *fase = &fases[i];
+  if (fase->rampa && generador().generateDouble() >= avanceRampa(*fase, t))
+    fase = i > 0 ? &fases[i - 1] : nullptr;
+  if (!fase)
+    return {};
+
+  Decision d;
+  for (const auto &f : fase->fallas) {
+    if (!f.ruta.isEmpty() && f.ruta != QLatin1String(ruta))
+      continue;
+
+    const auto x = generador().generateDouble() * 100;
+    if (x < f.timeouts) {
+      ++timeouts;
+      d.efecto = Efecto::Timeout;
+      return d;
+    }
+    if (x < f.timeouts + f.errores) {
+      ++errores;
+      d.efecto = Efecto::Error;
+      return d;
+    }
+  }
+
+  if (fase->p50 >= 0)
+    d.delay = muestra(fase->p50);
+  return d;
+}
+
+bool activo() { return !fases.isEmpty(); }
+
+QJsonObject estado() {
+  const auto t = transcurrido();
+  const auto i = faseEn(t);
+
+  QJsonObject e{
+      {"transcurridoMs", t},
+      {"fase", i + 1},
+      {"descripcion", i < 0 ? QString("normal") : fases[i].texto.join("; ")},
+      {"timeouts", qint64(timeouts.load())},
+      {"errores", qint64(errores.load())},
+  };
+  if (i >= 0 && fases[i].rampa)
+    e["avanceRampa"] = avanceRampa(fases[i], t);
+  return e;
+}
+
+} // namespace escenario
+
+/*
+ * Lógica de los endpoints del POS, independiente del transporte.
+ *
+ * Los handlers REST y el protocolo binario convierten su entrada a una
+ * Solicitud, llaman a procesar() y serializan el Resultado cada uno a su
+ * manera. Las validaciones y los datos de la respuesta viven solo acá.
+ */
+namespace pos {
+
+bool esValida(quint8 op) {
+  return op >= quint8(Operacion::Eco) &&
+         op <= quint8(Operacion::VentaBilletera);
+}
+
+const char *ruta(Operacion op) {
+  switch (op) {
+  case Operacion::Eco:
+    return endpoint::eco;
+  case Operacion::VentaUx:
+    return endpoint::ventaUx;
+  case Operacion::Credito:
+    return endpoint::credito;
+  case Operacion::Debito:
+    return endpoint::debito;
+  case Operacion::Descuento:
+    return endpoint::descuento;
+  case Operacion::VentaQr:
+    return endpoint::ventaQr;
+  case Operacion::VentaCanje:
+    return endpoint::ventaCanje;
+  case Operacion::VentaBilletera:
+    return endpoint::ventaBilletera;
+  }
+  return "";
+}
+
+bool devuelveNsuBin(Operacion op) {
+  return op == Operacion::VentaUx || op == Operacion::Credito ||
+         op == Operacion::Debito;
+}
+
+static Resultado rechazo(QHttpServerResponder::StatusCode status,
+                         const QString &error, const QString &mensaje) {
+  Resultado r;
+  r.status = status;
+  r.error = error;
+  r.mensaje = mensaje;
+  return r;
+}
+
+Solicitud desdeJson(Operacion op, const QJsonObject &req) {
+  Solicitud s;
+  s.operacion = op;
+
+  if (const QJsonValue v = req.value("eco"); v.isDouble()) {
+    s.tieneEco = true;
+    s.eco = v.toInt();
+  }
+  s.facturaNro = req.value("facturaNro").toInteger();
+  s.cuotas = req.value("cuotas").toInt();
+  s.plan = req.value("plan").toInt();
+  s.monto = req.value("monto").toInteger();
+  s.nsu = req.value("nsu").toString();
+  s.bin = req.value("bin").toString();
+
+  if (const QJsonValue v = req.value("pan"); v.isString())
+    s.pan = v.toString().toULongLong();
+  else
+    s.pan = quint64(v.toInteger());
+  return s;
+}
+
+static std::optional<Resultado> validarEco(const Solicitud &s) {
+  if (!s.tieneEco)
+    return rechazo(QHttpServerResponder::StatusCode::BadRequest,
+                   "Solicitud mal formada", "Lo que recibí es basura");
+
+  if (s.eco < 0 || s.eco >= 100)
+    return rechazo(QHttpServerResponder::StatusCode::BadRequest,
+                   "Bad request",
+                   QString("Valor fuera del rango admitido [%1]: %2")
+                       .arg("1-99")
+                       .arg(s.eco));
+
+  return std::nullopt;
+}
+
+static std::optional<Resultado> validarVenta(const Solicitud &s) {
+  if (s.facturaNro < 1 || s.facturaNro > 99999999999)
+    return rechazo(QHttpServerResponder::StatusCode::NotAcceptable,
+                   "Bad request", "Número de factura inválido");
+
+  if (s.operacion != Operacion::Debito &&
+      (s.cuotas < 0 || s.cuotas > 99 || s.plan < 0 || s.plan > 1))
+    return rechazo(QHttpServerResponder::StatusCode::NotAcceptable,
+                   "Bad request", "Combinación inválida de Cuotas/Plan");
+
+  return std::nullopt;
+}
+
+static std::optional<Resultado> validarPago(const Solicitud &s) {
+  if (s.operacion == Operacion::Descuento) {
+    if (s.nsu.trimmed().isEmpty() || s.bin.trimmed().isEmpty() || s.monto < 1)
+      return rechazo(QHttpServerResponder::StatusCode::NotAcceptable,
+                     "Bad request", "NSU o BIN o MONTO inválido");
+  } else if (s.monto < 10 || s.facturaNro < 10) {
+    return rechazo(QHttpServerResponder::StatusCode::NotAcceptable,
+                   "Bad request", "NÚMERO DE FACTURA o MONTO inválido");
+  }
+
+  /*
+   * Espero que los errores transaccionales
+   * no se respondan en este nivel de abstracción
+   * ESTO ES SOLO UNA PRUEBA
+   *
+   * Con dataset, el saldo real se controla al debitar (ver aprobarPago).
+   */
+  if (!datos::cargado() && s.monto > 1000000)
+    return rechazo(QHttpServerResponder::StatusCode::BadRequest,
+                   "Bad request", "Saldo insuficiente");
+
+  return std::nullopt;
+}
+
+static Resultado aprobarVenta(const Solicitud &s) {
+  const QString prefijo = s.operacion == Operacion::VentaUx ? "UX" : "";
+
+  Resultado r;
+  r.nsu = prefijo + QString::number(util::randomInt(1, 9999999));
+  r.bin = prefijo + QString::number(util::randomInt(1, 999999));
+
+  switch (s.operacion) {
+  case Operacion::VentaUx:
+    r.delay = 1500 + 1500;
+    break;
+  case Operacion::Credito:
+    r.delay = 1500;
+    break;
+  default:
+    break;
+  }
+  return r;
+}
+
+/// Debita el monto de la cuenta del dataset que corresponde a la solicitud.
+static std::optional<Resultado> debitar(const Solicitud &s, Resultado &r) {
+  const auto clave = s.operacion == Operacion::Descuento
+                         ? quint64(qHash(s.nsu + s.bin, 0))
+                         : quint64(s.facturaNro);
+  const auto fila = datos::elegir(
+      s.pan, clave, s.operacion == Operacion::VentaBilletera);
+  if (!fila)
+    return rechazo(QHttpServerResponder::StatusCode::BadRequest,
+                   "Bad request", "Tarjeta no encontrada");
+
+  const auto debito = datos::debitar(*fila, s.monto);
+  if (!debito.ok)
+    return rechazo(QHttpServerResponder::StatusCode::BadRequest,
+                   "Bad request", debito.motivo);
+
+  const auto cuenta = datos::cuenta(*fila);
+  r.issuerId = cuenta.issuerId;
+  r.montoVuelto = 0;
+  r.saldo = debito.saldo;
+  r.nombreCliente = cuenta.titular;
+  r.pan = int(cuenta.pan % 10000);
+  r.nombreTarjeta = cuenta.billetera
+                        ? QString::fromUtf8(cuenta.marca)
+                        : QString::fromUtf8(cuenta.marca) + u' ' +
+                              QString::fromUtf8(cuenta.tipo).toUpper();
+  return std::nullopt;
+}
+
+static Resultado aprobarPago(const Solicitud &s) {
+  Resultado r;
+  r.codigoAutorizacion = QString::number(util::randomInt(1, 999999));
+  r.codigoComercio = QString::number(util::randomLong(1, 9999999999));
+  r.nroBoleta = QString::number(util::randomLong(1, 9999999999));
+
+  if (datos::cargado()) {
+    if (auto rechazado = debitar(s, r))
+      return *rechazado;
+  } else {
+    r.issuerId = "ZZ";
+    r.montoVuelto = util::randomInt(0, 500000);
+    r.saldo = util::randomInt(1, 500000000);
+    r.nombreCliente = "Nombre de Alguien";
+    r.pan = util::randomInt(1, 9999);
+    r.nombreTarjeta = "VISA ZZZZZZZ";
+  }
+
+  switch (s.operacion) {
+  case Operacion::VentaQr:
+    r.mensajeDisplay = "APROBADA (QR)";
+    break;
+  case Operacion::VentaCanje:
+    r.mensajeDisplay = "APROBADA (CANJE)";
+    break;
+  case Operacion::VentaBilletera:
+    r.mensajeDisplay = "APROBADA (BILLETERA)";
+    break;
+  default:
+    r.mensajeDisplay = "APROBADA";
+    break;
+  }
+  return r;
+}
+
+/// Devuelve el rechazo correspondiente, o nada si la solicitud es válida.
+std::optional<Resultado> validar(const Solicitud &s) {
+  switch (s.operacion) {
+  case Operacion::Eco:
+    return validarEco(s);
+  case Operacion::VentaUx:
+  case Operacion::Credito:
+  case Operacion::Debito:
+    return validarVenta(s);
+  case Operacion::Descuento:
+  case Operacion::VentaQr:
+  case Operacion::VentaCanje:
+  case Operacion::VentaBilletera:
+    return validarPago(s);
+  }
+  return rechazo(QHttpServerResponder::StatusCode::BadRequest, "Bad request",
+                 "Operación desconocida");
+}
+
+/// Arma la respuesta de una solicitud que ya pasó validar(). Con dataset
+/// puede rechazarla todavía, si la cuenta no tiene saldo.
+Resultado aprobar(const Solicitud &s) {
+  switch (s.operacion) {
+  case Operacion::Eco: {
+    Resultado r;
+    r.delay = 8; // 10 + (val * 10);
+    return r;
+  }
+  case Operacion::VentaUx:
+  case Operacion::Credito:
+  case Operacion::Debito:
+    return aprobarVenta(s);
+  default:
+    return aprobarPago(s);
+  }
+}
+
+static lote::Tipo tipoDeLote(Operacion op) {
+  switch (op) {
+  case Operacion::Debito:
+    return lote::Debito;
+  case Operacion::Descuento:
+    return lote::Descuento;
+  case Operacion::VentaQr:
+    return lote::Qr;
+  case Operacion::VentaCanje:
+    return lote::Canje;
+  case Operacion::VentaBilletera:
+    return lote::Billetera;
+  default:
+    return lote::Credito;
+  }
+}
+
+static QString nsuBin(const QString &nsu, const QString &bin) {
+  return nsu.trimmed() + u'/' + bin.trimmed();
+}
+
+/// Número del NSU, sin el prefijo de las ventas UX.
+static quint32 numeroNsu(const QString &nsu) {
+  auto numero = QStringView(nsu).trimmed();
+  if (numero.startsWith(u"UX"))
+    numero = numero.sliced(2);
+  return numero.toUInt();
+}
+
+/*
+ * Las ventas con tarjeta se aprueban en dos pasos: crédito, débito y
+ * venta-ux devuelven NSU y BIN, y el descuento con ese NSU/BIN trae el monto
+ * y la cuenta. Se registran una sola vez, al llegar el descuento, con el tipo
+ * y la factura de la venta y el NSU como autorización. Un descuento sin venta
+ * conocida queda como descuento.
+ */
+static void registrarEnLote(const Solicitud &s, const Resultado &r) {
+  switch (s.operacion) {
+  case Operacion::Eco:
+    return;
+  case Operacion::VentaUx:
+  case Operacion::Credito:
+  case Operacion::Debito:
+    lote::abrirVenta(nsuBin(r.nsu, r.bin), tipoDeLote(s.operacion),
+                     s.facturaNro);
+    return;
+  case Operacion::Descuento:
+    if (const auto venta = lote::tomarVenta(nsuBin(s.nsu, s.bin))) {
+      lote::registrar(venta->tipo, r.issuerId, s.monto, venta->facturaNro,
+                      r.pan, numeroNsu(s.nsu));
+      return;
+    }
+    break;
+  default:
+    break;
+  }
+  lote::registrar(tipoDeLote(s.operacion), r.issuerId, s.monto, s.facturaNro,
+                  r.pan, r.codigoAutorizacion.toUInt());
+}
+
+Resultado procesar(const Solicitud &s) {
+  if (auto r = validar(s))
+    return *r;
+
+  const auto decision = escenario::decidir(ruta(s.operacion));
+  if (decision.efecto == escenario::Efecto::Timeout) {
+    auto r = rechazo(QHttpServerResponder::StatusCode::GatewayTimeout,
+                     "Gateway timeout", "El autorizador no respondió");
+    r.delay = escenario::timeoutMs;
+    return r;
+  }
+  if (decision.efecto == escenario::Efecto::Error)
+    return rechazo(QHttpServerResponder::StatusCode::ServiceUnavailable,
+                   "Service unavailable", "Autorizador no disponible");
+
+  auto r = aprobar(s);
+  if (decision.delay >= 0)
+    r.delay = decision.delay;
+  if (r.ok())
+    registrarEnLote(s, r);
+  return r;
+}
+
+QJsonObject aJson(const Solicitud &s, const Resultado &r) {
+  if (!r.ok())
+    return makeErrorResponse(r.error, r.mensaje, (int)r.status);
+
+  if (s.operacion == Operacion::Eco)
+    return QJsonObject{{"eco", s.eco}};
+
+  if (devuelveNsuBin(s.operacion)) {
+    QJsonObject nsuBin;
+    nsuBin["nsu"] = r.nsu;
+    nsuBin["bin"] = r.bin;
+    return nsuBin;
+  }
+
+  QJsonObject resp;
+  resp["codigoAutorizacion"] = r.codigoAutorizacion;
+  resp["codigoComercio"] = r.codigoComercio;
+  resp["issuerId"] = r.issuerId;
+  resp["mensajeDisplay"] = r.mensajeDisplay;
+  resp["montoVuelto"] = r.montoVuelto;
+  resp["saldo"] = r.saldo;
+  resp["nombreCliente"] = r.nombreCliente;
+  resp["pan"] = r.pan;
+  resp["nombreTarjeta"] = r.nombreTarjeta;
+  resp["nroBoleta"] = r.nroBoleta;
+  return resp;
+}
+
+} // namespace pos
+
+/*
+ * Adaptador REST: mismo flujo para todos los endpoints del POS.
+ *
+ * La latencia simulada no bloquea el event loop: la respuesta se difiere con
+ * un timer atado a la conexión y cuenta como "en vuelo" hasta que se envía
+ * (o hasta que el cliente corta). Las respuestas que se envían por el
+ * responder no pasan por afterRequest, así que los headers se agregan acá.
+ */
+static void enviar(QHttpServerResponder &responder, QHttpServerResponse &&resp,
+                   traza::Etapas &etapas) {
+  etapas.status = int(resp.statusCode());
+  responder.sendResponse(server::agregarHeaders(std::move(resp)));
+  etapas.envio = traza::ahora();
+  traza::registrar(std::move(etapas));
+}
+
+static void responderOperacion(const QHttpServerRequest &request,
+                               QHttpServerResponder &responder,
+                               const QByteArray &path, pos::Operacion op) {
+  traza::Etapas etapas;
+  etapas.nombre = path;
+  etapas.llegada = traza::llegada();
+  etapas.inicio = traza::ahora();
+
+  if (auto rechazo = rechazarSolicitud(request, path)) {
+    enviar(responder, std::move(*rechazo), etapas);
+    return;
+  }
+
+  const std::optional<QJsonObject> json =
+      byteArrayToJsonObject(request.body());
+
+  if (!json) {
+    const auto status = QHttpServerResponder::StatusCode::BadRequest;
+    auto eResp = makeErrorResponse("Bad request", "JSON inválido", (int)status);
+
+    qDebug().noquote().nospace()
+        << request.url().toDisplayString(QUrl::RemoveQuery) << " <==\n"
+        << util::recortar(request.body()) << Qt::endl
+        << "==> [" << (int)status << "]\n"
+        << QJsonDocument(eResp).toJson(QJsonDocument::Indented) << "\n";
+
+    enviar(responder, QHttpServerResponse(eResp, status), etapas);
+    return;
+  }
+
+  auto req = json.value();
+
+  const auto solicitud = pos::desdeJson(op, req);
+  const auto resultado = pos::procesar(solicitud);
+
+  // El eco devuelve lo mismo que recibió
+  const auto resp = op == pos::Operacion::Eco && resultado.ok()
+                        ? req
+                        : pos::aJson(solicitud, resultado);
+
+  etapas.finProceso = traza::ahora();
+
+  auto completar = [url = request.url().toDisplayString(QUrl::RemoveQuery),
+                    req, resp, status = resultado.status](
+                       QHttpServerResponder &responder, traza::Etapas &etapas) {
+    qDebug().noquote().nospace()
+        << url << " <==\n"
+        << util::recortar(req) << "==> [" << (int)status << "]\n"
+        << QJsonDocument(resp).toJson(QJsonDocument::Indented) << "\n";
+
+    enviar(responder, QHttpServerResponse(resp, status), etapas);
+  };
+
+  if (resultado.delay <= 0) {
+    completar(responder, etapas);
+    return;
+  }
+
+  qDebug().noquote().nospace()
+      << " > Simulando delay de " << resultado.delay << "ms";
+
+  auto pendiente =
+      std::make_shared<QHttpServerResponder>(std::move(responder));
+
+  tiempo::despues(resultado.delay, server::conexionActual(),
+                  [pendiente, completar, etapas,
+                   vuelo = apagado::registrarEnVuelo()]() mutable {
+                    etapas.finDelay = traza::ahora();
+                    completar(*pendiente, etapas);
+                  });
+}
+
+static void routeOperacion(QHttpServer &httpServer,
+                           QHttpServerRequest::Method method,
+                           const QByteArray &path, pos::Operacion op) {
+  httpServer.route(path, method,
+                   [path, op](const QHttpServerRequest &request,
+                              QHttpServerResponder &&responder) {
+                     responderOperacion(request, responder, path, op);
+                   });
+}
+
+void handleEco(QHttpServer &httpServer, QHttpServerRequest::Method method,
+               const QByteArray &path) {
+  routeOperacion(httpServer, method, path, pos::Operacion::Eco);
+}
+
+void handleVentaUx(QHttpServer &httpServer, QHttpServerRequest::Method method,
+                   const QByteArray &path) {
+  routeOperacion(httpServer, method, path, pos::Operacion::VentaUx);
+}
+
+void handleVentaCredito(QHttpServer &httpServer,
+                        QHttpServerRequest::Method method,
+                        const QByteArray &path) {
+  routeOperacion(httpServer, method, path, pos::Operacion::Credito);
+}
+
+void handleVentaDebito(QHttpServer &httpServer,
+                       QHttpServerRequest::Method method, QByteArray path) {
+  routeOperacion(httpServer, method, path, pos::Operacion::Debito);
+}
+
+void handleMontoDescuento(QHttpServer &httpServer,
+                          QHttpServerRequest::Method method,
+                          const QByteArray &path) {
+  routeOperacion(httpServer, method, path, pos::Operacion::Descuento);
+}
+
+void handleVentaQr(QHttpServer &httpServer, QHttpServerRequest::Method method,
+                   const QByteArray &path) {
+  routeOperacion(httpServer, method, path, pos::Operacion::VentaQr);
+}
+
+void handleVentaCanje(QHttpServer &httpServer,
+                      QHttpServerRequest::Method method,
+                      const QByteArray &path) {
+  routeOperacion(httpServer, method, path, pos::Operacion::VentaCanje);
+}
+
+void handleVentaBilletera(QHttpServer &httpServer,
+                          QHttpServerRequest::Method method,
+                          const QByteArray &path) {
+  routeOperacion(httpServer, method, path, pos::Operacion::VentaBilletera);
 }
 
 void handleListarIssuers(QHttpServer &httpServer,
@@ -692,40 +2565,9 @@ void handleListarIssuers(QHttpServer &httpServer,
   httpServer.route(path, method, []() {
     QJsonArray lista;
 
-    lista << QJsonObject{
-        {"Marca", "CABAL"}, {"Tipo", "Crédito"}, {"IssuerID", "CB"}};
-    lista << QJsonObject{
-        {"Marca", "CREDIFIELCO"}, {"Tipo", "Crédito"}, {"IssuerID", "CC"}};
-    lista << QJsonObject{
-        {"Marca", "CARTA CLAVE"}, {"Tipo", "Crédito"}, {"IssuerID", "CL"}};
-    lista << QJsonObject{
-        {"Marca", "PANAL"}, {"Tipo", "Crédito"}, {"IssuerID", "CP"}};
-    lista << QJsonObject{
-        {"Marca", "DINERS"}, {"Tipo", "Crédito"}, {"IssuerID", "DC"}};
-    lista << QJsonObject{
-        {"Marca", "INFONET"}, {"Tipo", "Débito"}, {"IssuerID", "ID"}};
-    lista << QJsonObject{
-        {"Marca", "MASTERCARD"}, {"Tipo", "Crédito"}, {"IssuerID", "MC"}};
-    lista << QJsonObject{
-        {"Marca", "MASTERCARD"}, {"Tipo", "Débito"}, {"IssuerID", "MD"}};
-    lista << QJsonObject{
-        {"Marca", "CREDICARD"}, {"Tipo", "Crédito"}, {"IssuerID", "PC"}};
-    lista << QJsonObject{
-        {"Marca", "UNICA"}, {"Tipo", "Débito"}, {"IssuerID", "UD"}};
-    lista << QJsonObject{
-        {"Marca", "VISA"}, {"Tipo", "Crédito"}, {"IssuerID", "VC"}};
-    lista << QJsonObject{
-        {"Marca", "VISA"}, {"Tipo", "Débito"}, {"IssuerID", "VD"}};
-    lista << QJsonObject{
-        {"Marca", "TARJETA DEBITO"}, {"Tipo", "Débito"}, {"IssuerID", "TD"}};
-    lista << QJsonObject{
-        {"Marca", "TARJETA CREDITO"}, {"Tipo", "Crédito"}, {"IssuerID", "TC"}};
-    lista << QJsonObject{
-        {"Marca", "DEBITO EN CUENTA"}, {"Tipo", "Débito"}, {"IssuerID", "CD"}};
-    lista << QJsonObject{
-        {"Marca", "AMERICAN EXPRESS"}, {"Tipo", "Crédito"}, {"IssuerID", "AC"}};
-    lista << QJsonObject{
-        {"Marca", "BANCARD"}, {"Tipo", "Crédito"}, {"IssuerID", "BC"}};
+    for (const auto &e : catalogo::issuers)
+      lista << QJsonObject{
+          {"Marca", e.marca}, {"Tipo", e.tipo}, {"IssuerID", e.issuerId}};
 
     return lista;
   });
@@ -737,26 +2579,691 @@ void handleListarBilleteras(QHttpServer &httpServer,
   httpServer.route(path, method, []() {
     QJsonArray lista;
 
-    lista << QJsonObject{
-        {"Marca", "ZIMPLE"}, {"CodigoBilletera", "ZIM"}, {"IssuerID", "ZM"}};
-    lista << QJsonObject{{"Marca", "Paraguayo Japonesa"},
-                         {"CodigoBilletera", "WPJ"},
-                         {"IssuerID", "PJ"}};
-    lista << QJsonObject{
-        {"Marca", "VISION"}, {"CodigoBilletera", "VBV"}, {"IssuerID", "VB"}};
-    lista << QJsonObject{{"Marca", "Personal-Itau"},
-                         {"CodigoBilletera", "BPI"},
-                         {"IssuerID", "PI"}};
-    lista << QJsonObject{{"Marca", "Billetera Viru"},
-                         {"CodigoBilletera", "BBF"},
-                         {"IssuerID", "BF"}};
+    for (const auto &b : catalogo::billeteras)
+      lista << QJsonObject{{"Marca", b.marca},
+                           {"CodigoBilletera", b.codigo},
+                           {"IssuerID", b.issuerId}};
 
     return lista;
   });
 }
 
+void handleMetricas(QHttpServer &httpServer, QHttpServerRequest::Method method,
+                    const QByteArray &path) {
+  httpServer.route(path, method, []() {
+    auto metricas = traza::metricas();
+    if (escenario::activo())
+      metricas["escenario"] = escenario::estado();
+    return metricas;
+  });
+}
+
+void handleCierre(QHttpServer &httpServer, QHttpServerRequest::Method method,
+                  const QByteArray &path) {
+  httpServer.route(path, method, [path]() {
+    const auto cierre = lote::cerrar();
+    qDebug().noquote() << path << " ==> " << util::recortar(cierre);
+    return cierre;
+  });
+}
+
+/*
+ * Listado paginado: ?lote=N (0 o ausente: el lote abierto), ?desde=cursor
+ * (el "siguiente" de la página anterior) y ?limite=N (hasta 1000).
+ */
+void handleTransacciones(QHttpServer &httpServer,
+                         QHttpServerRequest::Method method,
+                         const QByteArray &path) {
+  static constexpr int limitePorDefecto = 100;
+  static constexpr int limiteMaximo = 1000;
+
+  httpServer.route(path, method, [](const QHttpServerRequest &request) {
+    const QUrlQuery query(request.url());
+    bool ok = true;
+    const auto numero =
+        query.hasQueryItem("lote") ? query.queryItemValue("lote").toInt(&ok)
+                                   : 0;
+    const auto desde = query.queryItemValue("desde").toULongLong();
+    auto limite = query.queryItemValue("limite").toInt();
+    if (limite <= 0)
+      limite = limitePorDefecto;
+
+    const auto pagina =
+        ok ? lote::listar(numero, desde, qMin(limite, limiteMaximo))
+           : std::nullopt;
+    if (!pagina) {
+      const auto status = QHttpServerResponder::StatusCode::NotFound;
+      return QHttpServerResponse(
+          makeErrorResponse("Not found",
+                            QString("No existe el lote %1")
+                                .arg(query.queryItemValue("lote")),
+                            (int)status),
+          status);
+    }
+    return QHttpServerResponse(*pagina);
+  });
+}
+
+void handleReloj(QHttpServer &httpServer, QHttpServerRequest::Method method,
+                 const QByteArray &path) {
+  httpServer.route(path, method, []() { return tiempo::estado(); });
+}
+
+/// En modo paso adelanta el reloj virtual: {"ms": n}.
+void handleRelojAvanzar(QHttpServer &httpServer,
+                        QHttpServerRequest::Method method,
+                        const QByteArray &path) {
+  httpServer.route(path, method, [path](const QHttpServerRequest &request) {
+    if (!tiempo::modoPaso) {
+      const auto status = QHttpServerResponder::StatusCode::Conflict;
+      return QHttpServerResponse(
+          makeErrorResponse("Conflict", "El reloj no está en modo paso",
+                            (int)status),
+          status);
+    }
+
+    const auto json = byteArrayToJsonObject(request.body());
+    if (!json || !json->value("ms").isDouble() ||
+        json->value("ms").toInteger() < 0) {
+      const auto status = QHttpServerResponder::StatusCode::BadRequest;
+      return QHttpServerResponse(
+          makeErrorResponse("Bad request", "Falta \"ms\" o es negativo",
+                            (int)status),
+          status);
+    }
+
+    const auto disparadas = tiempo::avanzar(json->value("ms").toInteger());
+    auto estado = tiempo::estado();
+    estado["disparadas"] = disparadas;
+    qDebug().noquote() << path << " ==> " << util::recortar(estado);
+    return QHttpServerResponse(estado);
+  });
+}
+
+/*
+ * Transporte binario para benchmarks de alto volumen.
+ *
+ * Cada trama va precedida por su largo (u32, big-endian, sin contarse a sí
+ * mismo). Todos los enteros son big-endian y los textos se codifican como
+ * u16 de largo + UTF-8.
+ *
+ * Solicitud:
+ *   op:u8 flags:u8 id:u32 facturaNro:i64 cuotas:i32 plan:i32 monto:i64
+ *   eco:i64 nsu:str bin:str pan:u64              (flags bit 0: trae eco)
+ *
+ * Respuesta:
+ *   op:u8 status:u16 id:u32, y según el caso:
+ *     error:              error:str mensaje:str
+ *     eco:                eco:i64
+ *     venta-ux/créd/déb:  nsu:str bin:str
+ *     resto:              codigoAutorizacion:str codigoComercio:str
+ *                         issuerId:str mensajeDisplay:str montoVuelto:i64
+ *                         saldo:i64 nombreCliente:str pan:i32
+ *                         nombreTarjeta:str nroBoleta:str
+ *
+ * Las respuestas llevan el id de la solicitud y pueden llegar en otro orden
+ * (la latencia simulada no bloquea la conexión), así que un cliente puede
+ * tener muchas solicitudes en vuelo sobre la misma conexión.
+ */
+namespace binario {
+
+static bool simularDelay = true;
+
+class Escritor {
+public:
+  void u8(quint8 v) { buf.append(char(v)); }
+  void u16(quint16 v) { escribir(qToBigEndian(v)); }
+  void u32(quint32 v) { escribir(qToBigEndian(v)); }
+  void i32(qint32 v) { escribir(qToBigEndian(v)); }
+  void i64(qint64 v) { escribir(qToBigEndian(v)); }
+  void u64(quint64 v) { escribir(qToBigEndian(v)); }
+  void str(const QString &v) {
+    const auto utf8 = v.toUtf8().left(0xffff);
+    u16(quint16(utf8.size()));
+    buf.append(utf8);
+  }
+
+  /// Devuelve la trama completa, con el largo al principio.
+  QByteArray trama() const {
+    const auto largo = qToBigEndian(quint32(buf.size()));
+    return QByteArray(reinterpret_cast<const char *>(&largo), sizeof largo) +
+           buf;
+  }
+
+private:
+  template <typename T> void escribir(T v) {
+    buf.append(reinterpret_cast<const char *>(&v), sizeof v);
+  }
+
+  QByteArray buf;
+};
+
+class Lector {
+public:
+  Lector(const char *data, qsizetype size) : p(data), fin(data + size) {}
+
+  bool ok() const { return valido; }
+
+  quint8 u8() { return leer<quint8>(); }
+  quint16 u16() { return leer<quint16>(); }
+  quint32 u32() { return leer<quint32>(); }
+  qint32 i32() { return leer<qint32>(); }
+  qint64 i64() { return leer<qint64>(); }
+  quint64 u64() { return leer<quint64>(); }
+  QString str() {
+    const auto largo = u16();
+    if (!valido || fin - p < largo) {
+      valido = false;
+      return {};
+    }
+    const auto v = QString::fromUtf8(p, largo);
+    p += largo;
+    return v;
+  }
+
+private:
+  template <typename T> T leer() {
+    if (!valido || fin - p < qsizetype(sizeof(T))) {
+      valido = false;
+      return T{};
+    }
+    const auto v = qFromBigEndian<T>(p);
+    p += sizeof(T);
+    return v;
+  }
+
+  const char *p;
+  const char *fin;
+  bool valido = true;
+};
+
+/// Arma la trama de una solicitud; la usan los clientes y las pruebas.
+QByteArray codificarSolicitud(const pos::Solicitud &s, quint32 id) {
+  Escritor w;
+  w.u8(quint8(s.operacion));
+  w.u8(s.tieneEco ? 1 : 0);
+  w.u32(id);
+  w.i64(s.facturaNro);
+  w.i32(s.cuotas);
+  w.i32(s.plan);
+  w.i64(s.monto);
+  w.i64(s.eco);
+  w.str(s.nsu);
+  w.str(s.bin);
+  w.u64(s.pan);
+  return w.trama();
+}
+
+/// Decodifica el cuerpo de una trama (sin el largo). Aunque la trama esté mal
+/// formada, `id` queda con el id de la solicitud si se llegó a leer (si no, 0).
+std::optional<pos::Solicitud> decodificarSolicitud(const char *data,
+                                                   qsizetype size,
+                                                   quint32 &id) {
+  Lector r(data, size);
+  pos::Solicitud s;
+
+  const auto op = r.u8();
+  s.tieneEco = r.u8() & 1;
+  id = r.u32();
+  s.facturaNro = r.i64();
+  s.cuotas = r.i32();
+  s.plan = r.i32();
+  s.monto = r.i64();
+  s.eco = r.i64();
+  s.nsu = r.str();
+  s.bin = r.str();
+  s.pan = r.u64();
+
+  if (!r.ok() || !pos::esValida(op))
+    return std::nullopt;
+
+  s.operacion = pos::Operacion(op);
+  return s;
+}
+
+QByteArray codificarResultado(const pos::Solicitud &s,
+                              const pos::Resultado &r, quint32 id) {
+  Escritor w;
+  w.u8(quint8(s.operacion));
+  w.u16(quint16(r.status));
+  w.u32(id);
+
+  if (!r.ok()) {
+    w.str(r.error);
+    w.str(r.mensaje);
+  } else if (s.operacion == pos::Operacion::Eco) {
+    w.i64(s.eco);
+  } else if (pos::devuelveNsuBin(s.operacion)) {
+    w.str(r.nsu);
+    w.str(r.bin);
+  } else {
+    w.str(r.codigoAutorizacion);
+    w.str(r.codigoComercio);
+    w.str(r.issuerId);
+    w.str(r.mensajeDisplay);
+    w.i64(r.montoVuelto);
+    w.i64(r.saldo);
+    w.str(r.nombreCliente);
+    w.i32(r.pan);
+    w.str(r.nombreTarjeta);
+    w.str(r.nroBoleta);
+  }
+  return w.trama();
+}
+
+static QByteArray tramaDeError(
+    quint32 id, const QString &mensaje,
+    QHttpServerResponder::StatusCode status =
+        QHttpServerResponder::StatusCode::BadRequest,
+    pos::Operacion op = pos::Operacion::Eco) {
+  pos::Solicitud s;
+  s.operacion = op;
+  pos::Resultado r;
+  r.status = status;
+  r.error = status == QHttpServerResponder::StatusCode::BadRequest
+                ? "Bad request"
+                : "Service unavailable";
+  r.mensaje = mensaje;
+  return codificarResultado(s, r, id);
+}
+
+/*
+ * Atiende una conexión ya creada en el hilo actual. El largo declarado se
+ * verifica antes de acumular la trama, así que un cliente no puede hacer
+ * que el servidor guarde más de --max-body bytes por conexión.
+ */
+void atenderConexion(QIODevice *socket) {
+  auto buffer = std::make_shared<QByteArray>();
+
+  QObject::connect(socket, &QIODevice::readyRead, socket, [socket, buffer] {
+    const auto llegada = traza::ahora();
+    buffer->append(socket->readAll());
+
+    const auto max = limits::maxBodyPorDefecto;
+    qsizetype consumido = 0;
+
+    while (buffer->size() - consumido >= qsizetype(sizeof(quint32))) {
+      const auto largo =
+          qFromBigEndian<quint32>(buffer->constData() + consumido);
+
+      if (qsizetype(largo) > max) {
+        qDebug().noquote().nospace()
+            << "binario <== trama de " << largo << " bytes, límite " << max;
+        socket->write(tramaDeError(
+            0, QString("La trama excede el límite de %1 bytes").arg(max)));
+        socket->close();
+        return;
+      }
+
+      if (buffer->size() - consumido < qsizetype(sizeof(quint32) + largo))
+        break;
+
+      quint32 id = 0;
+      const auto solicitud = decodificarSolicitud(
+          buffer->constData() + consumido + sizeof(quint32), largo, id);
+      consumido += sizeof(quint32) + largo;
+
+      if (!solicitud) {
+        socket->write(tramaDeError(id, "Trama mal formada"));
+        continue;
+      }
+
+      // El binario no tiene "Connection: close": se avisa con un 503 para
+      // que el cliente se reconecte.
+      if (apagado::drenando) {
+        socket->write(tramaDeError(
+            id, "El simulador se está apagando",
+            QHttpServerResponder::StatusCode::ServiceUnavailable,
+            solicitud->operacion));
+        continue;
+      }
+
+      // Se registra siempre, para que /metricas cuente también el binario.
+      // El nombre apunta al literal de la ruta, sin copiarlo.
+      const auto *ruta = pos::ruta(solicitud->operacion);
+      traza::Etapas etapas;
+      etapas.nombre = QByteArray::fromRawData(ruta, qstrlen(ruta));
+      etapas.llegada = llegada;
+      etapas.inicio = traza::ahora();
+
+      const auto resultado = pos::procesar(*solicitud);
+      auto respuesta = codificarResultado(*solicitud, resultado, id);
+
+      etapas.status = int(resultado.status);
+      etapas.finProceso = traza::ahora();
+
+      auto enviar = [socket, respuesta](traza::Etapas etapas) {
+        socket->write(respuesta);
+        etapas.envio = traza::ahora();
+        traza::registrar(std::move(etapas));
+      };
+
+      if (simularDelay && resultado.delay > 0)
+        tiempo::despues(resultado.delay, socket,
+                        [enviar, etapas,
+                         vuelo = apagado::registrarEnVuelo()]() mutable {
+                          etapas.finDelay = traza::ahora();
+                          enviar(std::move(etapas));
+                        });
+      else
+        enviar(std::move(etapas));
+    }
+
+    buffer->remove(0, consumido);
+  });
+}
+
+/*
+ * Hilos que atienden las conexiones binarias. Cada conexión vive en un solo
+ * hilo (round-robin al aceptar), así no hace falta sincronizar el socket.
+ */
+class Trabajadores {
+public:
+  explicit Trabajadores(int cantidad) {
+    for (int i = 0; i < qMax(1, cantidad); ++i) {
+      auto *hilo = new QThread;
+      auto *contexto = new QObject;
+      contexto->moveToThread(hilo);
+      QObject::connect(hilo, &QThread::finished, contexto,
+                       &QObject::deleteLater);
+      hilo->start();
+      QMetaObject::invokeMethod(
+          contexto, [i] { escenario::sembrarHilo(quint32(i + 1)); });
+      hilos.push_back({hilo, contexto});
+    }
+  }
+
+  ~Trabajadores() {
+    for (auto &[hilo, contexto] : hilos) {
+      hilo->quit();
+      hilo->wait();
+      delete hilo;
+    }
+  }
+
+  void atender(qintptr descriptor, bool local) {
+    auto *contexto = hilos[siguiente++ % hilos.size()].second;
+
+    QMetaObject::invokeMethod(contexto, [contexto, descriptor, local] {
+      if (local) {
+        auto *socket = new QLocalSocket(contexto);
+        socket->setSocketDescriptor(descriptor);
+        QObject::connect(socket, &QLocalSocket::disconnected, socket,
+                         &QObject::deleteLater);
+        atenderConexion(socket);
+      } else {
+        auto *socket = new QTcpSocket(contexto);
+        socket->setSocketDescriptor(descriptor);
+        socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+        QObject::connect(socket, &QTcpSocket::disconnected, socket,
+                         &QObject::deleteLater);
+        atenderConexion(socket);
+      }
+    });
+  }
+
+private:
+  std::vector<std::pair<QThread *, QObject *>> hilos;
+  size_t siguiente = 0;
+};
+
+class ServidorTcp : public QTcpServer {
+public:
+  explicit ServidorTcp(Trabajadores &trabajadores)
+      : trabajadores(trabajadores) {}
+
+protected:
+  void incomingConnection(qintptr descriptor) override {
+    trabajadores.atender(descriptor, false);
+  }
+
+private:
+  Trabajadores &trabajadores;
+};
+
+class ServidorLocal : public QLocalServer {
+public:
+  explicit ServidorLocal(Trabajadores &trabajadores)
+      : trabajadores(trabajadores) {}
+
+protected:
+  void incomingConnection(quintptr descriptor) override {
+    trabajadores.atender(qintptr(descriptor), true);
+  }
+
+private:
+  Trabajadores &trabajadores;
+};
+
+} // namespace binario
+
+// Los benchmarks (bench.cpp) compilan este archivo sin main().
+#ifndef SIMULADOR_SIN_MAIN
 int main(int argc, char *argv[]) {
+  traza::reloj.start();
+
   QCoreApplication a(argc, argv);
+  QCoreApplication::setApplicationName("SimuladorPOS");
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription(
+      "Simulador de la API REST de los POS de Bancard");
+  parser.addHelpOption();
+
+  QCommandLineOption maxBodyOption(
+      "max-body",
+      QCoreApplication::translate(
+          "SimuladorPOS",
+          "Tamaño máximo del cuerpo de las solicitudes, en bytes. Con la forma "
+          "<ruta>=<bytes> aplica solo a esa ruta. Se puede repetir."),
+      "[ruta=]bytes");
+  QCommandLineOption contentTypeOption(
+      "exigir-content-type",
+      QCoreApplication::translate(
+          "SimuladorPOS",
+          "Rechazar solicitudes sin Content-Type: application/json."));
+  QCommandLineOption portOption(
+      "port",
+      QCoreApplication::translate(
+          "SimuladorPOS",
+          "Puerto TCP para las rutas HTTP (0 elige uno libre)."),
+      "puerto", QString::number(server::default_port));
+  QCommandLineOption unixSocketOption(
+      "unix-socket",
+      QCoreApplication::translate(
+          "SimuladorPOS",
+          "Atender también las rutas HTTP en este Unix domain socket."),
+      "ruta");
+  QCommandLineOption sinTcpOption(
+      "sin-tcp",
+      QCoreApplication::translate(
+          "SimuladorPOS",
+          "No escuchar en TCP; usar solo --unix-socket."));
+  QCommandLineOption binarioOption(
+      "binario",
+      QCoreApplication::translate(
+          "SimuladorPOS",
+          "Atender también el protocolo binario en este puerto TCP."),
+      "puerto");
+  QCommandLineOption binarioSocketOption(
+      "binario-socket",
+      QCoreApplication::translate(
+          "SimuladorPOS",
+          "Atender también el protocolo binario en este socket local."),
+      "ruta");
+  QCommandLineOption binarioHilosOption(
+      "binario-hilos",
+      QCoreApplication::translate(
+          "SimuladorPOS", "Hilos para el protocolo binario (por defecto, uno "
+                          "por núcleo)."),
+      "n", QString::number(QThread::idealThreadCount()));
+  QCommandLineOption binarioSinDelayOption(
+      "binario-sin-delay",
+      QCoreApplication::translate(
+          "SimuladorPOS",
+          "No simular latencia en el protocolo binario."));
+  QCommandLineOption trazaOption(
+      "traza",
+      QCoreApplication::translate(
+          "SimuladorPOS",
+          "Escribir una traza Chrome trace-event/Perfetto en este archivo."),
+      "archivo");
+  QCommandLineOption umbralLentoOption(
+      "umbral-lento",
+      QCoreApplication::translate(
+          "SimuladorPOS", "Loguear el detalle por etapa de toda solicitud que "
+                          "tarde más que esto (0 desactiva)."),
+      "ms", "0");
+  QCommandLineOption sondaLagOption(
+      "sonda-lag",
+      QCoreApplication::translate(
+          "SimuladorPOS", "Intervalo de la sonda de lag del event loop."),
+      "ms", "100");
+  QCommandLineOption plazoDrenajeOption(
+      "plazo-drenaje",
+      QCoreApplication::translate(
+          "SimuladorPOS", "Al apagar, cuánto esperar a las respuestas en "
+                          "vuelo antes de terminar."),
+      "ms", "30000");
+  QCommandLineOption controlOption(
+      "control",
+      QCoreApplication::translate(
+          "SimuladorPOS", "Socket de control por el que un proceso nuevo "
+                          "puede tomar los sockets de este (ver --relevar)."),
+      "ruta");
+  QCommandLineOption relevarOption(
+      "relevar",
+      QCoreApplication::translate(
+          "SimuladorPOS", "Tomar los sockets TCP de un proceso que atiende "
+                          "--control en esta ruta, y apagarlo."),
+      "ruta");
+  QCommandLineOption datasetOption(
+      "dataset",
+      QCoreApplication::translate(
+          "SimuladorPOS", "Archivo con el dataset de tarjetas y billeteras "
+                          "sintéticas; las ventas debitan sus saldos."),
+      "archivo");
+  QCommandLineOption datasetGenerarOption(
+      "dataset-generar",
+      QCoreApplication::translate(
+          "SimuladorPOS", "Generar el archivo de --dataset con esta cantidad "
+                          "de cuentas (reemplaza el existente)."),
+      "n");
+  QCommandLineOption datasetSemillaOption(
+      "dataset-semilla",
+      QCoreApplication::translate("SimuladorPOS",
+                                  "Semilla para --dataset-generar."),
+      "n", "1");
+  parser.addOption(maxBodyOption);
+  parser.addOption(contentTypeOption);
+  parser.addOption(portOption);
+  parser.addOption(unixSocketOption);
+  parser.addOption(sinTcpOption);
+  parser.addOption(binarioOption);
+  parser.addOption(binarioSocketOption);
+  parser.addOption(binarioHilosOption);
+  parser.addOption(binarioSinDelayOption);
+  parser.addOption(trazaOption);
+  parser.addOption(umbralLentoOption);
+  parser.addOption(sondaLagOption);
+  parser.addOption(plazoDrenajeOption);
+  parser.addOption(controlOption);
+  parser.addOption(relevarOption);
+  parser.addOption(datasetOption);
+  parser.addOption(datasetGenerarOption);
+  parser.addOption(datasetSemillaOption);
+  QCommandLineOption relojVelocidadOption(
+      "reloj-velocidad",
+      QCoreApplication::translate(
+          "SimuladorPOS", "Cuántas veces más rápido que el tiempo real corre "
+                          "el reloj virtual (latencias, plazos, fechas)."),
+      "x", "1");
+  QCommandLineOption relojPasoOption(
+      "reloj-paso",
+      QCoreApplication::translate(
+          "SimuladorPOS", "El reloj virtual solo avanza con POST "
+                          "/reloj/avanzar."));
+  QCommandLineOption relojInicioOption(
+      "reloj-inicio",
+      QCoreApplication::translate(
+          "SimuladorPOS", "Fecha inicial del reloj virtual (ISO 8601)."),
+      "fecha");
+  QCommandLineOption escenarioOption(
+      "escenario",
+      QCoreApplication::translate(
+          "SimuladorPOS", "Aplicar a todos los endpoints la latencia y las "
+                          "fallas por fase de este archivo."),
+      "archivo");
+  QCommandLineOption escenarioSemillaOption(
+      "escenario-semilla",
+      QCoreApplication::translate("SimuladorPOS",
+                                  "Semilla de los sorteos de --escenario."),
+      "n", "1");
+  parser.addOption(relojVelocidadOption);
+  parser.addOption(relojPasoOption);
+  parser.addOption(relojInicioOption);
+  parser.addOption(escenarioOption);
+  parser.addOption(escenarioSemillaOption);
+  parser.process(a);
+
+  auto inicio = QDateTime::currentDateTime();
+  if (parser.isSet(relojInicioOption)) {
+    inicio = QDateTime::fromString(parser.value(relojInicioOption),
+                                   Qt::ISODateWithMs);
+    if (!inicio.isValid()) {
+      qWarning().noquote() << QCoreApplication::translate(
+                                  "SimuladorPOS", "Error: fecha inválida: %1")
+                                  .arg(parser.value(relojInicioOption));
+      return -1;
+    }
+  }
+  const auto velocidad = parser.value(relojVelocidadOption).toDouble();
+  if (velocidad <= 0) {
+    qWarning().noquote() << QCoreApplication::translate(
+                                "SimuladorPOS", "Error: velocidad inválida: %1")
+                                .arg(parser.value(relojVelocidadOption));
+    return -1;
+  }
+  tiempo::configurar(velocidad, parser.isSet(relojPasoOption),
+                     inicio.toMSecsSinceEpoch());
+
+  if (parser.isSet(escenarioOption) &&
+      !escenario::cargar(parser.value(escenarioOption),
+                         parser.value(escenarioSemillaOption).toUInt()))
+    return -1;
+
+  for (const auto &spec : parser.values(maxBodyOption)) {
+    if (!limits::configurar(spec)) {
+      qWarning().noquote() << QCoreApplication::translate(
+                                  "SimuladorPOS", "Error: límite inválido: %1")
+                                  .arg(spec);
+      return -1;
+    }
+  }
+  limits::exigirContentType = parser.isSet(contentTypeOption);
+
+  traza::umbralLentoUs = parser.value(umbralLentoOption).toLongLong() * 1000;
+  if (parser.isSet(trazaOption) && !traza::abrir(parser.value(trazaOption)))
+    return -1;
+  traza::iniciarSonda(&a, qMax(1, parser.value(sondaLagOption).toInt()));
+
+  if (parser.isSet(datasetGenerarOption) && !parser.isSet(datasetOption)) {
+    qWarning().noquote() << QCoreApplication::translate(
+        "SimuladorPOS", "Error: --dataset-generar requiere --dataset.");
+    return -1;
+  }
+
+  if (parser.isSet(datasetOption)) {
+    const auto ruta = parser.value(datasetOption);
+    const bool ok =
+        parser.isSet(datasetGenerarOption)
+            ? datos::generar(ruta,
+                             parser.value(datasetGenerarOption).toULongLong(),
+                             parser.value(datasetSemillaOption).toUInt())
+            : datos::abrir(ruta);
+    if (!ok)
+      return -1;
+  }
 
   QHttpServer httpServer;
 
@@ -775,29 +3282,315 @@ int main(int argc, char *argv[]) {
   // misc - listados
   handleListarIssuers(httpServer, GET, endpoint::listarIssuers);       //  OK
   handleListarBilleteras(httpServer, GET, endpoint::listarBilleteras); //  OK
+  handleMetricas(httpServer, GET, endpoint::metricas);
 
-  httpServer.afterRequest([](QHttpServerResponse &&resp) {
-    resp.setHeader("Server", "SimuladorPOS");
-    resp.setHeader("Autor", "Diego Schulz");
+  // conciliación
+  handleCierre(httpServer, POST, endpoint::cierre);
+  handleTransacciones(httpServer, GET, endpoint::transacciones);
 
-    return std::move(resp);
+  // reloj virtual
+  handleReloj(httpServer, GET, endpoint::reloj);
+  handleRelojAvanzar(httpServer, POST, endpoint::relojAvanzar);
+
+  httpServer.afterRequest([](QHttpServerResponse &&resp) {
+    return server::agregarHeaders(std::move(resp));
   });
 
-  const auto port = httpServer.listen(QHostAddress::Any, 3000);
-  if (!port) {
-    qWarning().noquote().nospace() << QCoreApplication::translate(
-        "SimuladorPOS", "Error: no se pudo escuchar en el puerto 3000, "
-                        "posiblemente ya hay otro proceso pegado al puerto.");
+  if (parser.isSet(sinTcpOption) && !parser.isSet(unixSocketOption)) {
+    qWarning().noquote() << QCoreApplication::translate(
+        "SimuladorPOS", "Error: --sin-tcp requiere --unix-socket.");
     return -1;
   }
 
+  QHash<char, int> heredados;
+#ifdef Q_OS_UNIX
+  if (parser.isSet(relevarOption)) {
+    const auto ruta = parser.value(relevarOption);
+    heredados = relevo::recibir(ruta);
+    if (heredados.isEmpty()) {
+      qWarning().noquote() << QCoreApplication::translate(
+                                  "SimuladorPOS",
+                                  "Error: no se recibieron sockets de %1")
+                                  .arg(ruta);
+      return -1;
+    }
+    qInfo().noquote() << QCoreApplication::translate(
+                             "SimuladorPOS", "Sockets recibidos de %1")
+                             .arg(ruta);
+  }
+#endif
+
+  /*
+   * Un socket heredado se usa solo si escucha donde se pidió: un Unix domain
+   * socket en la misma ruta, un socket TCP en el mismo puerto (o cualquiera,
+   * con 0). Si no, se cierra (sin borrar el archivo de un Unix domain
+   * socket); los que no pidió ninguna opción se cierran antes de arrancar.
+   */
+  const auto heredado = [&heredados](char etiqueta,
+                                     const QString &ruta) -> qintptr {
+#ifdef Q_OS_UNIX
+    if (!heredados.contains(etiqueta))
+      return -1;
+    const auto fd = heredados.take(etiqueta);
+    if (relevo::rutaDe(fd) == relevo::rutaCompleta(ruta))
+      return fd;
+    ::close(fd);
+#else
+    Q_UNUSED(etiqueta);
+    Q_UNUSED(ruta);
+#endif
+    return -1;
+  };
+  const auto heredadoTcp = [&heredados](char etiqueta,
+                                        quint16 puerto) -> qintptr {
+#ifdef Q_OS_UNIX
+    if (!heredados.contains(etiqueta))
+      return -1;
+    const auto fd = heredados.take(etiqueta);
+    if (puerto == 0 || relevo::puertoDe(fd) == puerto)
+      return fd;
+    ::close(fd);
+#else
+    Q_UNUSED(etiqueta);
+    Q_UNUSED(puerto);
+#endif
+    return -1;
+  };
+
+  server::ServidorUnix *servidorUnix = nullptr;
+  server::ServidorHttp *servidorTcp = nullptr;
+  std::unique_ptr<binario::Trabajadores> trabajadores;
+  std::unique_ptr<binario::ServidorTcp> binarioTcp;
+  std::unique_ptr<binario::ServidorLocal> binarioLocal;
+  std::unique_ptr<relevo::ServidorControl> control;
+
+  // Un socket local que ya atiende otro proceso es un error, como un puerto
+  // TCP en uso: no se le borra el archivo.
+  const auto ocupado = [](const QString &ruta) {
+    if (server::liberarRuta(ruta))
+      return false;
+    qWarning().noquote() << QCoreApplication::translate(
+                                "SimuladorPOS",
+                                "Error: otro proceso ya atiende el socket %1")
+                                .arg(ruta);
+    return true;
+  };
+
+  if (parser.isSet(unixSocketOption)) {
+    const auto ruta = parser.value(unixSocketOption);
+    const auto fd = heredado('u', ruta);
+    if (fd < 0 && ocupado(ruta))
+      return -1;
+    servidorUnix = new server::ServidorUnix;
+    if (fd >= 0 ? !servidorUnix->adoptar(fd) : !servidorUnix->escuchar(ruta)) {
+      qWarning().noquote() << QCoreApplication::translate(
+                                  "SimuladorPOS", "Error: no se pudo escuchar "
+                                                  "en el socket %1: %2")
+                                  .arg(ruta, servidorUnix->error());
+      delete servidorUnix;
+      return -1;
+    }
+    if (!server::vincular(httpServer, servidorUnix)) {
+      qWarning().noquote() << QCoreApplication::translate(
+                                  "SimuladorPOS",
+                                  "Error: QHttpServer no aceptó el socket %1")
+                                  .arg(ruta);
+      return -1;
+    }
+
+    qInfo().noquote() << QCoreApplication::translate(
+                             "SimuladorPOS", "Escuchando en unix:%1")
+                             .arg(servidorUnix->ruta());
+  }
+
+  if (!parser.isSet(sinTcpOption)) {
+    bool puertoOk = false;
+    const auto requested = parser.value(portOption).toUShort(&puertoOk);
+    if (!puertoOk) {
+      qWarning().noquote() << QCoreApplication::translate(
+                                  "SimuladorPOS", "Error: puerto inválido: %1")
+                                  .arg(parser.value(portOption));
+      return -1;
+    }
+    servidorTcp = new server::ServidorHttp;
+    const auto fd = heredadoTcp('h', requested);
+    const bool ok = fd >= 0
+                        ? servidorTcp->setSocketDescriptor(fd)
+                        : servidorTcp->listen(QHostAddress::Any, requested);
+    if (!ok) {
+      delete servidorTcp;
+      qWarning().noquote().nospace()
+          << QCoreApplication::translate(
+                 "SimuladorPOS",
+                 "Error: no se pudo escuchar en el puerto %1, "
+                 "posiblemente ya hay otro proceso pegado al puerto.")
+                 .arg(requested);
+      return -1;
+    }
+    if (!server::vincular(httpServer, servidorTcp)) {
+      qWarning().noquote() << QCoreApplication::translate(
+                                  "SimuladorPOS",
+                                  "Error: QHttpServer no aceptó el puerto %1")
+                                  .arg(servidorTcp->serverPort());
+      return -1;
+    }
+
+    qInfo().noquote() << QCoreApplication::translate(
+                             "SimuladorPOS", "Escuchando en http://127.0.0.1:%1/")
+                             .arg(servidorTcp->serverPort());
+  }
+
   qInfo().noquote() << QCoreApplication::translate(
-                           "SimuladorPOS", "Escuchando en http://127.0.0.1:%1/"
-                                           "\n(Presiona CTRL+C para terminar)")
-                           .arg(port);
+      "SimuladorPOS", "(Presiona CTRL+C para terminar)");
+
+  if (parser.isSet(binarioOption) || parser.isSet(binarioSocketOption)) {
+    binario::simularDelay = !parser.isSet(binarioSinDelayOption);
+    trabajadores = std::make_unique<binario::Trabajadores>(
+        parser.value(binarioHilosOption).toInt());
+  }
+
+  if (parser.isSet(binarioOption)) {
+    bool puertoOk = false;
+    const auto puerto = parser.value(binarioOption).toUShort(&puertoOk);
+    if (!puertoOk) {
+      qWarning().noquote() << QCoreApplication::translate(
+                                  "SimuladorPOS", "Error: puerto inválido: %1")
+                                  .arg(parser.value(binarioOption));
+      return -1;
+    }
+    binarioTcp = std::make_unique<binario::ServidorTcp>(*trabajadores);
+    const auto fd = heredadoTcp('b', puerto);
+    const bool ok = fd >= 0 ? binarioTcp->setSocketDescriptor(fd)
+                            : binarioTcp->listen(QHostAddress::Any, puerto);
+    if (!ok) {
+      qWarning().noquote() << QCoreApplication::translate(
+                                  "SimuladorPOS",
+                                  "Error: no se pudo escuchar en el puerto "
+                                  "binario %1: %2")
+                                  .arg(puerto)
+                                  .arg(binarioTcp->errorString());
+      return -1;
+    }
+    qInfo().noquote() << QCoreApplication::translate(
+                             "SimuladorPOS", "Protocolo binario en el puerto %1")
+                             .arg(binarioTcp->serverPort());
+  }
+
+  if (parser.isSet(binarioSocketOption)) {
+    const auto ruta = parser.value(binarioSocketOption);
+    binarioLocal = std::make_unique<binario::ServidorLocal>(*trabajadores);
+    const auto fd = heredado('l', ruta);
+    if (fd < 0 && ocupado(ruta))
+      return -1;
+    if (fd >= 0 ? !binarioLocal->listen(fd) : !binarioLocal->listen(ruta)) {
+      qWarning().noquote() << QCoreApplication::translate(
+                                  "SimuladorPOS",
+                                  "Error: no se pudo escuchar en el socket "
+                                  "binario %1: %2")
+                                  .arg(ruta, binarioLocal->errorString());
+      return -1;
+    }
+    qInfo().noquote() << QCoreApplication::translate(
+                             "SimuladorPOS", "Protocolo binario en %1")
+                             .arg(binarioLocal->fullServerName());
+  }
+
+  // Después de un relevo los Unix domain sockets son del proceso nuevo:
+  // se sueltan en vez de cerrarse, porque close() borraría sus archivos.
+  bool relevado = false;
+  const auto dejarDeAceptar = [&] {
+    if (servidorTcp)
+      servidorTcp->close();
+    if (binarioTcp)
+      binarioTcp->close();
+
+    if (relevado) {
+      if (servidorUnix)
+        servidorUnix->soltar();
+      if (binarioLocal)
+        server::soltar(binarioLocal.release());
+      if (control)
+        server::soltar(control.release());
+      return;
+    }
+
+    if (servidorUnix)
+      servidorUnix->cerrar();
+    if (binarioLocal)
+      binarioLocal->close();
+    if (control)
+      control->close();
+  };
+  const auto plazo = parser.value(plazoDrenajeOption).toInt();
+  const auto alApagar = [&dejarDeAceptar, plazo] {
+    apagado::iniciar(dejarDeAceptar, plazo);
+  };
+
+#ifdef Q_OS_UNIX
+  apagado::instalarSenales(alApagar);
+
+  if (parser.isSet(controlOption)) {
+    const auto ruta = parser.value(controlOption);
+    control = std::make_unique<relevo::ServidorControl>([&](int socket) {
+      QByteArray etiquetas;
+      QList<int> descriptores;
+      if (servidorTcp && servidorTcp->isListening()) {
+        etiquetas += 'h';
+        descriptores << int(servidorTcp->socketDescriptor());
+      }
+      if (binarioTcp && binarioTcp->isListening()) {
+        etiquetas += 'b';
+        descriptores << int(binarioTcp->socketDescriptor());
+      }
+      if (servidorUnix && servidorUnix->descriptor() >= 0) {
+        etiquetas += 'u';
+        descriptores << int(servidorUnix->descriptor());
+      }
+      if (binarioLocal && binarioLocal->isListening()) {
+        etiquetas += 'l';
+        descriptores << int(binarioLocal->socketDescriptor());
+      }
+      if (control->isListening()) {
+        etiquetas += 'c';
+        descriptores << int(control->socketDescriptor());
+      }
+
+      const bool ok = relevo::enviar(socket, etiquetas, descriptores);
+      if (ok) {
+        relevado = true;
+        QTimer::singleShot(0, qApp, alApagar);
+      }
+      return ok;
+    });
+
+    const auto fd = heredado('c', ruta);
+    if (fd < 0 && ocupado(ruta))
+      return -1;
+    if (fd >= 0 ? !control->listen(fd) : !control->listen(ruta)) {
+      qWarning().noquote() << QCoreApplication::translate(
+                                  "SimuladorPOS",
+                                  "Error: no se pudo escuchar en el socket "
+                                  "de control %1: %2")
+                                  .arg(ruta, control->errorString());
+      return -1;
+    }
+  }
 
-  return a.exec();
+  // Los heredados que no se usaron se cierran: si no, el kernel seguiría
+  // completando conexiones en un backlog que nadie acepta.
+  for (const auto fd : std::as_const(heredados))
+    ::close(fd);
+  heredados.clear();
+#endif
+
+  const auto salida = a.exec();
+  traza::cerrar();
+  datos::cerrar();
+  qInfo().noquote() << QCoreApplication::translate("SimuladorPOS",
+                                                   "Simulador terminado");
+  return salida;
 }
+#endif
 
 
 
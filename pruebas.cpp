@@ -0,0 +1,439 @@
+#include "simulador.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QHash>
+#include <QJsonArray>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QTest>
+#include <QThread>
+#include <QtEndian>
+
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <vector>
+
+/*
+ * Pruebas de la lógica que no se ve desde HTTP: el protocolo binario
+ * (ida y vuelta de las tramas, respuestas y tramas rotas) y la contabilidad
+ * del lote (cierres con ventas en curso, ventas con tarjeta).
+ */
+
+Q_DECLARE_METATYPE(pos::Solicitud)
+Q_DECLARE_METATYPE(pos::Resultado)
+
+namespace {
+
+/// Lee un texto del protocolo: u16 de largo + UTF-8.
+QString texto(QDataStream &in) {
+  quint16 largo = 0;
+  in >> largo;
+  QByteArray utf8(largo, Qt::Uninitialized);
+  if (in.readRawData(utf8.data(), largo) != largo)
+    in.setStatus(QDataStream::ReadPastEnd);
+  return QString::fromUtf8(utf8);
+}
+
+/// Cuerpo de una trama (sin el largo), después de verificar el largo.
+QByteArray cuerpo(const QByteArray &trama) {
+  if (trama.size() < 4 ||
+      qFromBigEndian<quint32>(trama.constData()) != quint32(trama.size() - 4))
+    return {};
+  return trama.sliced(4);
+}
+
+pos::Solicitud solicitud(pos::Operacion op) {
+  pos::Solicitud s;
+  s.operacion = op;
+  return s;
+}
+
+struct Totales {
+  qint64 cantidad = 0;
+  qint64 monto = 0;
+};
+
+struct Listado {
+  Totales total;
+  QHash<QString, Totales> porTipo;
+  QJsonArray transacciones;
+};
+
+/// Recorre todas las páginas de un lote cerrado.
+Listado listar(int numero) {
+  Listado listado;
+  QJsonValue desde = 0;
+  while (!desde.isNull()) {
+    const auto pagina = lote::listar(numero, quint64(desde.toInteger()), 1000);
+    if (!pagina)
+      break;
+    for (const auto &valor : pagina->value("transacciones").toArray()) {
+      const auto t = valor.toObject();
+      auto &tipo = listado.porTipo[t.value("tipo").toString()];
+      ++tipo.cantidad;
+      tipo.monto += t.value("monto").toInteger();
+      ++listado.total.cantidad;
+      listado.total.monto += t.value("monto").toInteger();
+      listado.transacciones << t;
+    }
+    desde = pagina->value("siguiente");
+  }
+  return listado;
+}
+
+} // namespace
+
+class PruebasPos : public QObject {
+  Q_OBJECT
+
+private:
+  /// Envía `trama` a una conexión binaria y devuelve la primera respuesta.
+  void conversar(const QByteArray &trama, QByteArray &respuesta) {
+    QLocalServer servidor;
+    const auto nombre = QString("simuladorpos-pruebas-%1")
+                            .arg(QCoreApplication::applicationPid());
+    QLocalServer::removeServer(nombre);
+    QVERIFY(servidor.listen(nombre));
+    connect(&servidor, &QLocalServer::newConnection, &servidor, [&] {
+      binario::atenderConexion(servidor.nextPendingConnection());
+    });
+
+    QLocalSocket cliente;
+    cliente.connectToServer(nombre);
+    QVERIFY(cliente.waitForConnected(1000));
+    cliente.write(trama);
+
+    QByteArray recibido;
+    QVERIFY(QTest::qWaitFor([&] {
+      recibido += cliente.readAll();
+      return recibido.size() >= 4 &&
+             recibido.size() >=
+                 4 + qsizetype(qFromBigEndian<quint32>(recibido.constData()));
+    }));
+    respuesta = recibido.first(
+        4 + qsizetype(qFromBigEndian<quint32>(recibido.constData())));
+  }
+
+private slots:
+  void initTestCase() {
+    tiempo::configurar(1.0, false, QDateTime::currentMSecsSinceEpoch());
+  }
+
+  void idaYVuelta_data() {
+    QTest::addColumn<pos::Solicitud>("s");
+
+    auto eco = solicitud(pos::Operacion::Eco);
+    eco.tieneEco = true;
+    eco.eco = -42;
+    QTest::newRow("eco") << eco;
+
+    auto credito = solicitud(pos::Operacion::Credito);
+    credito.facturaNro = 1234567890123;
+    credito.cuotas = 3;
+    credito.plan = 1;
+    QTest::newRow("credito") << credito;
+
+    auto descuento = solicitud(pos::Operacion::Descuento);
+    descuento.nsu = "UX1234567";
+    descuento.bin = "UX654321";
+    descuento.monto = 150000;
+    QTest::newRow("descuento") << descuento;
+
+    auto billetera = solicitud(pos::Operacion::VentaBilletera);
+    billetera.facturaNro = 10;
+    billetera.monto = std::numeric_limits<qint64>::max();
+    billetera.nsu = "ñandú";
+    billetera.pan = 595912345678ULL;
+    QTest::newRow("billetera") << billetera;
+  }
+
+  void idaYVuelta() {
+    QFETCH(pos::Solicitud, s);
+
+    const auto datos = cuerpo(binario::codificarSolicitud(s, 0xdeadbeef));
+    QVERIFY(!datos.isEmpty());
+
+    quint32 id = 0;
+    const auto d =
+        binario::decodificarSolicitud(datos.constData(), datos.size(), id);
+    QVERIFY(d);
+    QCOMPARE(id, 0xdeadbeefU);
+    QCOMPARE(d->operacion, s.operacion);
+    QCOMPARE(d->tieneEco, s.tieneEco);
+    QCOMPARE(d->eco, s.eco);
+    QCOMPARE(d->facturaNro, s.facturaNro);
+    QCOMPARE(d->cuotas, s.cuotas);
+    QCOMPARE(d->plan, s.plan);
+    QCOMPARE(d->monto, s.monto);
+    QCOMPARE(d->nsu, s.nsu);
+    QCOMPARE(d->bin, s.bin);
+    QCOMPARE(d->pan, s.pan);
+  }
+
+  void textoLargo() {
+    // Los textos se recortan a 0xffff bytes en vez de romper la trama.
+    auto s = solicitud(pos::Operacion::Descuento);
+    s.nsu = QString(70000, u'9');
+
+    const auto datos = cuerpo(binario::codificarSolicitud(s, 1));
+    quint32 id = 0;
+    const auto d =
+        binario::decodificarSolicitud(datos.constData(), datos.size(), id);
+    QVERIFY(d);
+    QCOMPARE(d->nsu.size(), qsizetype(0xffff));
+  }
+
+  void truncada() {
+    auto s = solicitud(pos::Operacion::Descuento);
+    s.nsu = "123";
+    s.bin = "456";
+    const auto datos = cuerpo(binario::codificarSolicitud(s, 77));
+
+    for (qsizetype n = 0; n < datos.size(); ++n) {
+      quint32 id = 0;
+      QVERIFY2(!binario::decodificarSolicitud(datos.constData(), n, id),
+               qPrintable(QString("largo %1").arg(n)));
+      // El id ocupa los bytes 2 a 5.
+      QCOMPARE(id, n >= 6 ? 77U : 0U);
+    }
+  }
+
+  void operacionInvalida() {
+    auto datos =
+        cuerpo(binario::codificarSolicitud(solicitud(pos::Operacion::Eco), 9));
+    for (const char op : {char(0), char(200)}) {
+      datos[0] = op;
+      quint32 id = 0;
+      QVERIFY(!binario::decodificarSolicitud(datos.constData(), datos.size(),
+                                             id));
+      QCOMPARE(id, 9U);
+    }
+  }
+
+  void resultado_data() {
+    QTest::addColumn<pos::Solicitud>("s");
+    QTest::addColumn<pos::Resultado>("r");
+
+    pos::Resultado error;
+    error.status = QHttpServerResponder::StatusCode::NotAcceptable;
+    error.error = "Bad request";
+    error.mensaje = "NSU o BIN o MONTO inválido";
+    QTest::newRow("error") << solicitud(pos::Operacion::Descuento) << error;
+
+    auto eco = solicitud(pos::Operacion::Eco);
+    eco.eco = 31416;
+    QTest::newRow("eco") << eco << pos::Resultado();
+
+    pos::Resultado venta;
+    venta.nsu = "UX42";
+    venta.bin = "UX4242";
+    QTest::newRow("venta-ux") << solicitud(pos::Operacion::VentaUx) << venta;
+
+    pos::Resultado pago;
+    pago.codigoAutorizacion = "123456";
+    pago.codigoComercio = "9876543210";
+    pago.issuerId = "ZZ";
+    pago.mensajeDisplay = "APROBADA (QR)";
+    pago.montoVuelto = 500;
+    pago.saldo = -1;
+    pago.nombreCliente = "NATALIA NUÑEZ";
+    pago.pan = 4242;
+    pago.nombreTarjeta = "VISA ZZZZZZZ";
+    pago.nroBoleta = "1";
+    QTest::newRow("pago") << solicitud(pos::Operacion::VentaQr) << pago;
+  }
+
+  void resultado() {
+    QFETCH(pos::Solicitud, s);
+    QFETCH(pos::Resultado, r);
+
+    const auto datos = cuerpo(binario::codificarResultado(s, r, 4321));
+    QVERIFY(!datos.isEmpty());
+
+    QDataStream in(datos); // big-endian, como el protocolo
+    quint8 op = 0;
+    quint16 status = 0;
+    quint32 id = 0;
+    in >> op >> status >> id;
+    QCOMPARE(op, quint8(s.operacion));
+    QCOMPARE(status, quint16(r.status));
+    QCOMPARE(id, 4321U);
+
+    if (!r.ok()) {
+      QCOMPARE(texto(in), r.error);
+      QCOMPARE(texto(in), r.mensaje);
+    } else if (s.operacion == pos::Operacion::Eco) {
+      qint64 eco = 0;
+      in >> eco;
+      QCOMPARE(eco, s.eco);
+    } else if (s.operacion == pos::Operacion::VentaUx) {
+      QCOMPARE(texto(in), r.nsu);
+      QCOMPARE(texto(in), r.bin);
+    } else {
+      QCOMPARE(texto(in), r.codigoAutorizacion);
+      QCOMPARE(texto(in), r.codigoComercio);
+      QCOMPARE(texto(in), r.issuerId);
+      QCOMPARE(texto(in), r.mensajeDisplay);
+      qint64 montoVuelto = 0;
+      qint64 saldo = 0;
+      in >> montoVuelto >> saldo;
+      QCOMPARE(montoVuelto, qint64(r.montoVuelto));
+      QCOMPARE(saldo, r.saldo);
+      QCOMPARE(texto(in), r.nombreCliente);
+      qint32 pan = 0;
+      in >> pan;
+      QCOMPARE(pan, r.pan);
+      QCOMPARE(texto(in), r.nombreTarjeta);
+      QCOMPARE(texto(in), r.nroBoleta);
+    }
+    QCOMPARE(in.status(), QDataStream::Ok);
+    QVERIFY(in.atEnd());
+  }
+
+  void tramaExcedida() {
+    // Solo el largo: el servidor rechaza sin esperar el resto.
+    QByteArray trama(4, Qt::Uninitialized);
+    qToBigEndian<quint32>(1 << 20, trama.data());
+
+    QByteArray respuesta;
+    conversar(trama, respuesta);
+    if (QTest::currentTestFailed())
+      return;
+
+    const auto datos = cuerpo(respuesta);
+    QDataStream in(datos);
+    quint8 op = 0;
+    quint16 status = 0;
+    quint32 id = 0;
+    in >> op >> status >> id;
+    QCOMPARE(status, quint16(400));
+    QCOMPARE(id, 0U);
+  }
+
+  void tramaMalFormada() {
+    auto trama =
+        binario::codificarSolicitud(solicitud(pos::Operacion::Eco), 77);
+    trama[4] = 0; // operación inválida
+
+    QByteArray respuesta;
+    conversar(trama, respuesta);
+    if (QTest::currentTestFailed())
+      return;
+
+    const auto datos = cuerpo(respuesta);
+    QDataStream in(datos);
+    quint8 op = 0;
+    quint16 status = 0;
+    quint32 id = 0;
+    in >> op >> status >> id;
+    QCOMPARE(status, quint16(400));
+    QCOMPARE(id, 77U); // el cliente puede saber a qué solicitud corresponde
+    QCOMPARE(texto(in), QString("Bad request"));
+    QCOMPARE(texto(in), QString("Trama mal formada"));
+  }
+
+  void cierreConcurrente() {
+    static constexpr int hilos = 4;
+    static constexpr int porHilo = 20000;
+
+    lote::cerrar(); // empieza con el lote abierto vacío
+
+    std::atomic<int> terminados{0};
+    std::vector<std::unique_ptr<QThread>> registradores;
+    for (int h = 0; h < hilos; ++h) {
+      registradores.emplace_back(QThread::create([h, &terminados] {
+        for (int i = 0; i < porHilo; ++i)
+          lote::registrar(lote::Tipo(i % lote::CantidadTipos), "ZZ",
+                          1 + i % 1000, i, i % 10000, quint32(h));
+        ++terminados;
+      }));
+      registradores.back()->start();
+    }
+
+    // Cierra una y otra vez mientras los hilos registran.
+    QList<QJsonObject> cierres;
+    while (terminados < hilos)
+      cierres << lote::cerrar();
+    for (auto &hilo : registradores)
+      QVERIFY(hilo->wait(30000));
+    cierres << lote::cerrar();
+
+    Totales total;
+    for (const auto &cierre : std::as_const(cierres)) {
+      const auto numero = cierre.value("lote").toInt();
+      const auto listado = listar(numero);
+      QCOMPARE(listado.total.cantidad, cierre.value("cantidad").toInteger());
+      QCOMPARE(listado.total.monto, cierre.value("monto").toInteger());
+
+      const auto porTipo = cierre.value("porTipo").toObject();
+      for (auto it = porTipo.begin(); it != porTipo.end(); ++it) {
+        const auto tipo = it.value().toObject();
+        QCOMPARE(listado.porTipo.value(it.key()).cantidad,
+                 tipo.value("cantidad").toInteger());
+        QCOMPARE(listado.porTipo.value(it.key()).monto,
+                 tipo.value("monto").toInteger());
+      }
+
+      total.cantidad += listado.total.cantidad;
+      total.monto += listado.total.monto;
+    }
+
+    qint64 montoPorHilo = 0;
+    for (int i = 0; i < porHilo; ++i)
+      montoPorHilo += 1 + i % 1000;
+    QCOMPARE(total.cantidad, qint64(hilos) * porHilo);
+    QCOMPARE(total.monto, hilos * montoPorHilo);
+  }
+
+  void ventaConDescuento_data() {
+    QTest::addColumn<int>("operacion");
+    QTest::addColumn<QString>("tipo");
+
+    QTest::newRow("credito") << int(pos::Operacion::Credito) << "credito";
+    QTest::newRow("debito") << int(pos::Operacion::Debito) << "debito";
+    QTest::newRow("venta-ux") << int(pos::Operacion::VentaUx) << "credito";
+  }
+
+  void ventaConDescuento() {
+    QFETCH(int, operacion);
+    QFETCH(QString, tipo);
+
+    lote::cerrar();
+
+    auto venta = solicitud(pos::Operacion(operacion));
+    venta.facturaNro = 1234;
+    const auto aprobada = pos::procesar(venta);
+    QVERIFY(aprobada.ok());
+
+    auto descuento = solicitud(pos::Operacion::Descuento);
+    descuento.nsu = aprobada.nsu;
+    descuento.bin = aprobada.bin;
+    descuento.monto = 12345;
+    QVERIFY(pos::procesar(descuento).ok());
+
+    // Una sola transacción, con el tipo y la factura de la venta y el monto
+    // del descuento.
+    const auto cierre = lote::cerrar();
+    QCOMPARE(cierre.value("cantidad").toInteger(), qint64(1));
+    QCOMPARE(cierre.value("monto").toInteger(), qint64(12345));
+    const auto porTipo = cierre.value("porTipo").toObject();
+    const auto cantidad = [&porTipo](const QString &tipo) {
+      return porTipo.value(tipo).toObject().value("cantidad").toInteger();
+    };
+    QCOMPARE(cantidad(tipo), qint64(1));
+    QCOMPARE(cantidad("descuento"), qint64(0));
+
+    const auto listado = listar(cierre.value("lote").toInt());
+    QCOMPARE(listado.transacciones.size(), qsizetype(1));
+    const auto t = listado.transacciones.first().toObject();
+    QCOMPARE(t.value("tipo").toString(), tipo);
+    QCOMPARE(t.value("monto").toInteger(), qint64(12345));
+    QCOMPARE(t.value("facturaNro").toInteger(), qint64(1234));
+  }
+};
+
+QTEST_GUILESS_MAIN(PruebasPos)
+
+#include "pruebas.moc"
@@ -0,0 +1,153 @@
+#ifndef SIMULADOR_H
+#define SIMULADOR_H
+
+#include <QByteArray>
+#include <QHttpServerResponder>
+#include <QHttpServerResponse>
+#include <QJsonObject>
+#include <QString>
+
+#include <optional>
+
+/*
+ * Lo que comparten el simulador (main.cpp), los benchmarks (bench.cpp) y las
+ * pruebas (pruebas.cpp): rutas, tipos de la lógica del POS, las funciones de
+ * cada etapa del camino de una solicitud, el lote y el protocolo binario.
+ */
+
+namespace endpoint {
+
+static constexpr auto eco = "/pos/eco";
+static constexpr auto ventaUx = "/pos/venta-ux";
+static constexpr auto credito = "/pos/venta/credito";
+static constexpr auto debito = "/pos/venta/debito";
+static constexpr auto descuento = "/pos/descuento";
+static constexpr auto ventaQr = "/pos/venta-qr";
+static constexpr auto ventaCanje = "/pos/venta-canje";
+static constexpr auto ventaBilletera = "/pos/venta-billetera";
+
+static constexpr auto listarIssuers = "/issuers/";
+static constexpr auto listarBilleteras = "/billeteras/";
+
+static constexpr auto metricas = "/metricas";
+
+static constexpr auto cierre = "/pos/cierre";
+static constexpr auto transacciones = "/pos/transacciones";
+
+static constexpr auto reloj = "/reloj";
+static constexpr auto relojAvanzar = "/reloj/avanzar";
+
+} // namespace endpoint
+
+namespace pos {
+
+enum class Operacion : quint8 {
+  Eco = 1,
+  VentaUx,
+  Credito,
+  Debito,
+  Descuento,
+  VentaQr,
+  VentaCanje,
+  VentaBilletera,
+};
+
+struct Solicitud {
+  Operacion operacion = Operacion::Eco;
+  bool tieneEco = false;
+  qint64 eco = 0;
+  qint64 facturaNro = 0;
+  int cuotas = 0;
+  int plan = 0;
+  qint64 monto = 0;
+  QString nsu;
+  QString bin;
+  quint64 pan = 0; // opcional: cuenta del dataset a debitar
+};
+
+struct Resultado {
+  QHttpServerResponder::StatusCode status =
+      QHttpServerResponder::StatusCode::Ok;
+  QString error;
+  QString mensaje;
+
+  /// Latencia simulada (ms) que el transporte aplica antes de responder.
+  int delay = 0;
+
+  // venta-ux, crédito y débito
+  QString nsu;
+  QString bin;
+
+  // descuento, QR, canje y billetera
+  QString codigoAutorizacion;
+  QString codigoComercio;
+  QString issuerId;
+  QString mensajeDisplay;
+  int montoVuelto = 0;
+  qint64 saldo = 0;
+  QString nombreCliente;
+  int pan = 0;
+  QString nombreTarjeta;
+  QString nroBoleta;
+
+  bool ok() const { return status == QHttpServerResponder::StatusCode::Ok; }
+};
+
+Solicitud desdeJson(Operacion op, const QJsonObject &req);
+std::optional<Resultado> validar(const Solicitud &s);
+Resultado aprobar(const Solicitud &s);
+Resultado procesar(const Solicitud &s);
+QJsonObject aJson(const Solicitud &s, const Resultado &r);
+
+} // namespace pos
+
+std::optional<QJsonObject> byteArrayToJsonObject(const QByteArray &arr);
+QJsonObject makeErrorResponse(const QString error, const QString message,
+                              int statusCode);
+
+namespace server {
+
+QHttpServerResponse agregarHeaders(QHttpServerResponse &&resp);
+
+} // namespace server
+
+namespace tiempo {
+
+void configurar(double multiplicador, bool paso, qint64 inicio);
+
+} // namespace tiempo
+
+namespace lote {
+
+enum Tipo : quint8 {
+  Credito,
+  Debito,
+  Qr,
+  Canje,
+  Billetera,
+  Descuento,
+  CantidadTipos
+};
+
+void registrar(Tipo tipo, const QString &issuer, qint64 monto,
+               qint64 facturaNro, int pan, quint32 autorizacion);
+QJsonObject cerrar();
+std::optional<QJsonObject> listar(int numeroLote, quint64 desde, int limite);
+
+} // namespace lote
+
+class QIODevice;
+
+namespace binario {
+
+QByteArray codificarSolicitud(const pos::Solicitud &s, quint32 id);
+std::optional<pos::Solicitud> decodificarSolicitud(const char *data,
+                                                   qsizetype size,
+                                                   quint32 &id);
+QByteArray codificarResultado(const pos::Solicitud &s,
+                              const pos::Resultado &r, quint32 id);
+void atenderConexion(QIODevice *socket);
+
+} // namespace binario
+
+#endif // SIMULADOR_H